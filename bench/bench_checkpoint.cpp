@@ -0,0 +1,91 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief Benchmarks for CheckPoint::print(), when its category is disabled,
+ * (the cost of leaving a CheckPoint in the code), and when it is enabled.
+ *
+ * These use Google Benchmark, e.g.
+ * @code
+ *    g++ -std=c++17 -O2 -DCBI_CHECKPOINTS=1 -Iinclude bench/bench_checkpoint.cpp \
+ *        src/CompuBrite/\*.cpp -lbenchmark -lbenchmark_main -pthread
+ * @endcode
+ * Without CBI_CHECKPOINTS, only BM_PrintDisabled is run, and measures
+ * a CheckPoint which has been compiled out.
+*/
+
+#include "CompuBrite/CheckPoint.h"
+
+#include <benchmark/benchmark.h>
+
+#include <sstream>
+
+namespace cbi = CompuBrite;
+
+namespace {
+
+/// print() to a CheckPoint whose category is not enabled.
+void BM_PrintDisabled(benchmark::State &state)
+{
+    std::ostringstream os;
+    cbi::CheckPoint cp(CBI_CATEGORY("bench-off"), os);
+    int i = 0;
+    for (auto _ : state) {
+        cp.print(CBI_HERE, "i = ", i++, "\n");
+    }
+    benchmark::DoNotOptimize(os);
+}
+BENCHMARK(BM_PrintDisabled);
+
+#ifdef CBI_CHECKPOINTS
+/// Construct a temporary CheckPoint and print() to it, as in the usual
+/// idiom, with its category disabled.
+void BM_PrintDisabledTemporary(benchmark::State &state)
+{
+    std::ostringstream os;
+    int i = 0;
+    for (auto _ : state) {
+        cbi::CheckPoint(CBI_CATEGORY("bench-off"), os).print(CBI_HERE, "i = ", i++, "\n");
+    }
+    benchmark::DoNotOptimize(os);
+}
+BENCHMARK(BM_PrintDisabledTemporary);
+
+/// print() to a CheckPoint whose category is enabled, formatting the
+/// message into a string stream, (so this doesn't measure the terminal).
+void BM_PrintEnabled(benchmark::State &state)
+{
+    cbi::CheckPoint::enable("bench-on");
+    std::ostringstream os;
+    cbi::CheckPoint cp(CBI_CATEGORY("bench-on"), os);
+    int i = 0;
+    for (auto _ : state) {
+        cp.print(CBI_HERE, "i = ", i++, "\n");
+        if (os.tellp() > (1 << 20)) {
+            os.str(std::string());
+        }
+    }
+    cbi::CheckPoint::disable("bench-on");
+}
+BENCHMARK(BM_PrintEnabled);
+#endif
+
+} // namespace
@@ -0,0 +1,133 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief Benchmarks for flat_map, against std::unordered_map, and for
+ * looking strings up in a string_pool.
+ *
+ * These use Google Benchmark, e.g.
+ * @code
+ *    g++ -std=c++17 -O2 -Iinclude bench/bench_flat_map.cpp \
+ *        src/CompuBrite/\*.cpp -lbenchmark -lbenchmark_main -pthread
+ * @endcode
+*/
+
+#include "CompuBrite/flat_map.h"
+#include "CompuBrite/string_record.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cbi = CompuBrite;
+
+namespace {
+
+/// range(0) distinct random integer keys.
+std::vector<std::uint64_t> int_keys(std::int64_t n)
+{
+    std::mt19937_64 random(42);
+    std::vector<std::uint64_t> keys(n);
+    for (auto &k : keys) {
+        k = random();
+    }
+    return keys;
+}
+
+/// range(0) distinct string keys, of 10 to 30 characters.
+std::vector<std::string> string_keys(std::int64_t n)
+{
+    std::vector<std::string> keys(n);
+    for (std::int64_t i = 0; i < n; ++i) {
+        keys[i] = "symbol_" + std::to_string(i * 7919) + std::string(i % 16, 'x');
+    }
+    return keys;
+}
+
+/// Look up each key, in a different order to that they were added in, in
+/// a map of all of them.
+template <typename Map, typename Keys>
+void find_all(benchmark::State &state, Keys keys)
+{
+    Map map;
+    map.reserve(keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        map.emplace(keys[i], i);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+
+    for (auto _ : state) {
+        std::size_t sum = 0;
+        for (auto &k : keys) {
+            sum += map.find(k)->second;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <typename Map>
+void BM_FindInt(benchmark::State &state)
+{
+    find_all<Map>(state, int_keys(state.range(0)));
+}
+
+template <typename Map>
+void BM_FindString(benchmark::State &state)
+{
+    find_all<Map>(state, string_keys(state.range(0)));
+}
+
+using StdIntMap = std::unordered_map<std::uint64_t, std::size_t>;
+using FlatIntMap = cbi::flat_map<std::uint64_t, std::size_t>;
+using StdStringMap = std::unordered_map<std::string, std::size_t>;
+using FlatStringMap = cbi::flat_map<std::string, std::size_t>;
+
+BENCHMARK_TEMPLATE(BM_FindInt, StdIntMap)->Arg(1 << 20)->Arg(10000000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_FindInt, FlatIntMap)->Arg(1 << 20)->Arg(10000000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_FindString, StdStringMap)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_FindString, FlatStringMap)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+
+/// Record strings which are already in a string_pool, (the lock free
+/// lookup).
+void BM_StringPoolLookup(benchmark::State &state)
+{
+    auto keys = string_keys(state.range(0));
+    cbi::string_pool pool;
+    pool.from_strings(keys);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+    for (auto _ : state) {
+        std::size_t sum = 0;
+        for (auto &k : keys) {
+            sum += pool.from_string(k).index();
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_StringPoolLookup)->Arg(1 << 14)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+
+} // namespace
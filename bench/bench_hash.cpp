@@ -0,0 +1,159 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief Benchmarks for the hash_util.h combiner, against the xor-shift
+ * combiner it replaced, and for fast_hash, against std::hash.
+ *
+ * These use Google Benchmark, e.g.
+ * @code
+ *    g++ -std=c++17 -O2 -Iinclude bench/bench_hash.cpp src/CompuBrite/fast_hash.cpp \
+ *        -lbenchmark -lbenchmark_main -pthread
+ * @endcode
+*/
+
+#include "CompuBrite/hash_util.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Pair = std::pair<int, int>;
+
+/// The combiner hash_util.h used to have.
+struct OldHash
+{
+    std::size_t operator()(const Pair &p) const
+    {
+        return std::hash<int>()(p.first) ^ (std::hash<int>()(p.second) << 1);
+    }
+};
+
+/// The combiner hash_util.h has now.
+using NewHash = std::hash<Pair>;
+
+/// A grid of range(0) x range(0) pairs, (the shape of key which clusters
+/// worst with the old combiner).
+std::vector<Pair> grid(std::int64_t n)
+{
+    std::vector<Pair> keys;
+    keys.reserve(n * n);
+    for (auto i = 0; i < n; ++i) {
+        for (auto j = 0; j < n; ++j) {
+            keys.emplace_back(i, j);
+        }
+    }
+    return keys;
+}
+
+/// Report how well Hash spreads the keys: the fraction of keys whose hash
+/// is shared with another key, and the longest chain in an unordered_set.
+template <typename Hash>
+void collisions(benchmark::State &state, const std::vector<Pair> &keys)
+{
+    std::unordered_set<std::size_t> hashes;
+    for (auto &k : keys) {
+        hashes.insert(Hash()(k));
+    }
+    std::unordered_set<Pair, Hash> set(keys.begin(), keys.end());
+    std::size_t longest = 0;
+    for (auto b = 0u; b < set.bucket_count(); ++b) {
+        longest = std::max(longest, set.bucket_size(b));
+    }
+    state.counters["collision_rate"] =
+        1.0 - static_cast<double>(hashes.size()) / static_cast<double>(keys.size());
+    state.counters["longest_chain"] = static_cast<double>(longest);
+}
+
+/// Hash every key in the grid.
+template <typename Hash>
+void BM_Hash(benchmark::State &state)
+{
+    auto keys = grid(state.range(0));
+    for (auto _ : state) {
+        std::size_t sum = 0;
+        for (auto &k : keys) {
+            sum += Hash()(k);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    collisions<Hash>(state, keys);
+}
+BENCHMARK_TEMPLATE(BM_Hash, OldHash)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_Hash, NewHash)->Arg(1000);
+
+/// Look every key in the grid up in an unordered_map, (which is where the
+/// clustering shows).
+template <typename Hash>
+void BM_Lookup(benchmark::State &state)
+{
+    auto keys = grid(state.range(0));
+    std::unordered_map<Pair, int, Hash> map;
+    for (auto &k : keys) {
+        map.emplace(k, k.first);
+    }
+    for (auto _ : state) {
+        std::int64_t sum = 0;
+        for (auto &k : keys) {
+            sum += map.find(k)->second;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    collisions<Hash>(state, keys);
+}
+BENCHMARK_TEMPLATE(BM_Lookup, OldHash)->Arg(300);
+BENCHMARK_TEMPLATE(BM_Lookup, NewHash)->Arg(300);
+
+/// The string hash string_record used to have.
+using OldStringHash = std::hash<std::string_view>;
+
+/// The string hash string_record has now.
+using NewStringHash = CompuBrite::fast_hasher;
+
+/// Hash a string of range(0) bytes.
+template <typename Hash>
+void BM_StringHash(benchmark::State &state)
+{
+    std::string str(state.range(0), '\0');
+    for (std::size_t i = 0; i < str.size(); ++i) {
+        str[i] = static_cast<char>('a' + i * 7 % 26);
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(str.data());
+        benchmark::DoNotOptimize(Hash()(str));
+    }
+    state.SetBytesProcessed(state.iterations() * str.size());
+}
+BENCHMARK_TEMPLATE(BM_StringHash, OldStringHash)->Arg(8)->Arg(32)->Arg(256)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_StringHash, NewStringHash)->Arg(8)->Arg(32)->Arg(256)->Arg(4096);
+
+} // namespace
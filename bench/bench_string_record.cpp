@@ -0,0 +1,112 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief Benchmarks for string_record::from_string(), for strings which are
+ * already in the pool, (hits), and for new strings, (misses), against the
+ * size of the pool and the number of threads.
+ *
+ * These use Google Benchmark, e.g.
+ * @code
+ *    g++ -std=c++17 -O2 -Iinclude bench/bench_string_record.cpp \
+ *        src/CompuBrite/\*.cpp -lbenchmark -lbenchmark_main -pthread
+ * @endcode
+*/
+
+#include "CompuBrite/string_record.h"
+
+#include <benchmark/benchmark.h>
+
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace cbi = CompuBrite;
+
+namespace {
+
+/// The pool for the current benchmark, which holds range(0) strings when
+/// each run starts.  string_record::from_string() is string_pool::global()
+/// .from_string(), so a pool of our own measures the same lookup without
+/// the global pool growing from one run to the next.
+std::unique_ptr<cbi::string_pool> pool;
+
+/// Write the key for n into buf.
+/// @return the key, which is a view of buf.
+std::string_view key(char (&buf)[24], std::uint64_t n)
+{
+    buf[0] = 'k';
+    auto r = std::to_chars(buf + 1, buf + sizeof(buf), n);
+    return std::string_view(buf, static_cast<std::size_t>(r.ptr - buf));
+}
+
+void setup(const benchmark::State &state)
+{
+    pool = std::make_unique<cbi::string_pool>();
+    char buf[24];
+    for (std::int64_t i = 0; i < state.range(0); ++i) {
+        pool->from_string(key(buf, static_cast<std::uint64_t>(i)));
+    }
+}
+
+void teardown(const benchmark::State &)
+{
+    pool.reset();
+}
+
+/// Look up strings which are all in the pool, in a scattered order.
+void BM_FromStringHit(benchmark::State &state)
+{
+    const auto size = static_cast<std::uint64_t>(state.range(0));
+    std::uint64_t n = static_cast<std::uint64_t>(state.thread_index()) * 7919;
+    char buf[24];
+    for (auto _ : state) {
+        n = (n + 40503) % size;
+        benchmark::DoNotOptimize(pool->from_string(key(buf, n)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/// Add strings which are not yet in the pool.  Each thread has its own
+/// keys, so every call is a miss, and the pool grows as the run goes on.
+void BM_FromStringMiss(benchmark::State &state)
+{
+    auto n = static_cast<std::uint64_t>(state.range(0)) +
+        (static_cast<std::uint64_t>(state.thread_index()) << 40);
+    char buf[24];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(pool->from_string(key(buf, n++)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_FromStringHit)
+    ->RangeMultiplier(32)->Range(1 << 10, 1 << 20)->ArgName("size")
+    ->ThreadRange(1, 8)->UseRealTime()
+    ->Setup(setup)->Teardown(teardown);
+
+BENCHMARK(BM_FromStringMiss)
+    ->RangeMultiplier(32)->Range(1 << 10, 1 << 20)->ArgName("size")
+    ->ThreadRange(1, 8)->UseRealTime()
+    ->Setup(setup)->Teardown(teardown);
+
+} // namespace
@@ -0,0 +1,107 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief Benchmarks for adding tasks to, and taking them from, a TaskQueue,
+ * in each Order.
+ *
+ * These use Google Benchmark, e.g.
+ * @code
+ *    g++ -std=c++17 -O2 -Iinclude bench/bench_task_queue.cpp \
+ *        src/CompuBrite/\*.cpp -lbenchmark -lbenchmark_main -pthread
+ * @endcode
+*/
+
+#include "CompuBrite/TaskQueue.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+namespace cbi = CompuBrite;
+
+namespace {
+
+using Order = cbi::TaskQueue::Order;
+
+/// Add range(1) tasks, then take and run them all, in the Order given by
+/// range(0).  The queue is reused, so after the first iteration it has
+/// reached its working size and neither add() nor take() allocates.
+void BM_QueueAddTake(benchmark::State &state)
+{
+    const auto order = static_cast<Order>(state.range(0));
+    const auto n = state.range(1);
+    cbi::TaskQueue queue(0, order);
+    std::int64_t runs = 0;
+    for (auto _ : state) {
+        for (auto i = 0; i < n; ++i) {
+            queue.add([&runs]() { ++runs; }, i & 7);
+        }
+        while (auto task = queue.take()) {
+            task();
+        }
+    }
+    benchmark::DoNotOptimize(runs);
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_QueueAddTake)
+    ->ArgsProduct({{static_cast<int>(Order::FIFO),
+                    static_cast<int>(Order::LIFO),
+                    static_cast<int>(Order::Priority)},
+                   {1, 64, 4096}})
+    ->ArgNames({"order", "tasks"});
+
+/// Add and take range(1) tasks from a bounded queue of the same capacity.
+void BM_QueueAddTakeBounded(benchmark::State &state)
+{
+    const auto order = static_cast<Order>(state.range(0));
+    const auto n = state.range(1);
+    cbi::TaskQueue queue(n, order);
+    std::int64_t runs = 0;
+    for (auto _ : state) {
+        for (auto i = 0; i < n; ++i) {
+            queue.add([&runs]() { ++runs; }, i & 7);
+        }
+        while (auto task = queue.take()) {
+            task();
+        }
+    }
+    benchmark::DoNotOptimize(runs);
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_QueueAddTakeBounded)
+    ->ArgsProduct({{static_cast<int>(Order::FIFO),
+                    static_cast<int>(Order::Priority)},
+                   {64, 4096}})
+    ->ArgNames({"order", "tasks"});
+
+/// Take from an empty queue, which is what an idle worker does most.
+void BM_QueueTakeEmpty(benchmark::State &state)
+{
+    cbi::TaskQueue queue;
+    for (auto _ : state) {
+        auto task = queue.take();
+        benchmark::DoNotOptimize(task);
+    }
+}
+BENCHMARK(BM_QueueTakeEmpty);
+
+} // namespace
@@ -0,0 +1,117 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief Benchmarks for ThreadPool task submission and dispatch.
+ *
+ * These use Google Benchmark, e.g.
+ * @code
+ *    g++ -std=c++17 -O2 -Iinclude bench/bench_threadpool.cpp \
+ *        src/CompuBrite/\*.cpp -lbenchmark -lbenchmark_main -pthread
+ * @endcode
+*/
+
+#include "CompuBrite/ThreadPool.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace cbi = CompuBrite;
+
+namespace {
+
+/// Wait until all of the tasks in a batch have run.
+void drain(const std::atomic<std::int64_t> &done, std::int64_t n)
+{
+    while (done.load(std::memory_order_acquire) != n) {
+        std::this_thread::yield();
+    }
+}
+
+/// Submit a fan-out of range(0) tiny tasks, one at a time, to a pool of
+/// range(1) threads.
+void BM_AddTask(benchmark::State &state)
+{
+    cbi::ThreadPool pool;
+    pool.activate(state.range(1));
+    const auto n = state.range(0);
+    std::atomic<std::int64_t> done{0};
+    for (auto _ : state) {
+        done = 0;
+        for (auto i = 0; i < n; ++i) {
+            pool << [&done]() { done.fetch_add(1, std::memory_order_release); };
+        }
+        drain(done, n);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_AddTask)
+    ->ArgsProduct({{16, 64, 256, 1024}, {1, 2, 4, 8}})
+    ->ArgNames({"tasks", "threads"})->UseRealTime();
+
+/// Submit the same fan-out with a single addTasks() call.
+void BM_AddTasks(benchmark::State &state)
+{
+    cbi::ThreadPool pool;
+    pool.activate(state.range(1));
+    const auto n = state.range(0);
+    std::atomic<std::int64_t> done{0};
+    std::vector<cbi::ThreadPool::Task> batch;
+    batch.reserve(n);
+    for (auto _ : state) {
+        done = 0;
+        for (auto i = 0; i < n; ++i) {
+            batch.emplace_back([&done]() { done.fetch_add(1, std::memory_order_release); });
+        }
+        pool.addTasks(std::move(batch));
+        drain(done, n);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_AddTasks)
+    ->ArgsProduct({{16, 64, 256, 1024}, {1, 2, 4, 8}})
+    ->ArgNames({"tasks", "threads"})->UseRealTime();
+
+/// Time the round trip of a single task through an idle pool, which is
+/// dominated by how quickly an idle thread notices it.  range(0) selects
+/// the IdlePolicy: 0 for sleeping, 1 for spinning, and range(1) the number
+/// of threads.
+void BM_RoundTrip(benchmark::State &state)
+{
+    cbi::ThreadPool pool;
+    pool.idlePolicy(state.range(0) ? cbi::ThreadPool::IdlePolicy::spinning()
+                                   : cbi::ThreadPool::IdlePolicy::sleeping());
+    pool.activate(state.range(1));
+    std::atomic<std::int64_t> done{0};
+    for (auto _ : state) {
+        done = 0;
+        pool << [&done]() { done.fetch_add(1, std::memory_order_release); };
+        drain(done, 1);
+    }
+}
+BENCHMARK(BM_RoundTrip)
+    ->ArgsProduct({{0, 1}, {1, 4}})
+    ->ArgNames({"spin", "threads"})->UseRealTime();
+
+} // namespace
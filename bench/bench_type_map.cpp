@@ -0,0 +1,147 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief Benchmarks for type_map::dispatch(), against a chain of
+ * dynamic_casts, in a message dispatcher.
+ *
+ * These use Google Benchmark, e.g.
+ * @code
+ *    g++ -std=c++17 -O2 -Iinclude bench/bench_type_map.cpp \
+ *        -lbenchmark -lbenchmark_main -pthread
+ * @endcode
+*/
+
+#include "CompuBrite/type_map.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace cbi = CompuBrite;
+
+namespace {
+
+constexpr std::size_t Kinds = 40;
+
+struct Message
+{
+    explicit Message(std::size_t id) : id(id) { }
+    virtual ~Message() = default;
+
+    std::size_t id;
+};
+
+template<std::size_t I>
+struct Kind : Message
+{
+    Kind();
+
+    int payload = static_cast<int>(I);
+};
+
+/// The handler for a kind of message.
+template<std::size_t I>
+struct Handler
+{
+    int operator()(const Kind<I> &msg) const  { return msg.payload * 3 + 1; }
+};
+
+template<typename Seq>
+struct make_handlers;
+
+template<std::size_t... Is>
+struct make_handlers<std::index_sequence<Is...> >
+{
+    using type = cbi::type_map<cbi::pair<Kind<Is>, Handler<Is> >...>;
+};
+
+using Handlers = make_handlers<std::make_index_sequence<Kinds> >::type;
+
+template<std::size_t I>
+Kind<I>::Kind() :
+    Message(Handlers::index_of<Kind>)
+{ }
+
+template<std::size_t... Is>
+std::unique_ptr<Message> make(std::size_t kind, std::index_sequence<Is...>)
+{
+    std::unique_ptr<Message> msg;
+    ((kind == Is ? (msg = std::make_unique<Kind<Is> >(), true) : false) || ...);
+    return msg;
+}
+
+/// Many messages, of random kinds.
+std::vector<std::unique_ptr<Message> > messages()
+{
+    std::mt19937 random(1);
+    std::vector<std::unique_ptr<Message> > msgs;
+    for (auto i = 0; i < 4096; ++i) {
+        msgs.push_back(make(random() % Kinds, std::make_index_sequence<Kinds>{}));
+    }
+    return msgs;
+}
+
+template<std::size_t... Is>
+int cast_chain(const Message &msg, std::index_sequence<Is...>)
+{
+    int result = 0;
+    ((dynamic_cast<const Kind<Is>*>(&msg) ?
+        (result = Handler<Is>{}(static_cast<const Kind<Is>&>(msg)), true) : false) || ...);
+    return result;
+}
+
+void BM_DynamicCast(benchmark::State &state)
+{
+    auto msgs = messages();
+    for (auto _ : state) {
+        int sum = 0;
+        for (auto &msg : msgs) {
+            sum += cast_chain(*msg, std::make_index_sequence<Kinds>{});
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * msgs.size());
+}
+BENCHMARK(BM_DynamicCast);
+
+void BM_Dispatch(benchmark::State &state)
+{
+    auto msgs = messages();
+    for (auto _ : state) {
+        int sum = 0;
+        for (auto &msg : msgs) {
+            sum += Handlers::dispatch(msg->id, [&](auto key, auto handler) {
+                using Type = typename decltype(key)::type;
+                return typename decltype(handler)::type{}(static_cast<const Type&>(*msg));
+            });
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * msgs.size());
+}
+BENCHMARK(BM_Dispatch);
+
+} // namespace
@@ -0,0 +1,150 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief Benchmarks for CompuBrite::visit, against std::visit, on wide
+ * variants, and on pairs of variants.
+ *
+ * These use Google Benchmark, e.g.
+ * @code
+ *    g++ -std=c++17 -O2 -Iinclude bench/bench_visit.cpp \
+ *        -lbenchmark -lbenchmark_main -pthread
+ *    clang++ -std=c++17 -O2 -Iinclude bench/bench_visit.cpp \
+ *        -lbenchmark -lbenchmark_main -pthread
+ * @endcode
+*/
+
+#include "CompuBrite/visit.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <random>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+template<std::size_t I>
+struct Alt
+{
+    int value = static_cast<int>(I);
+};
+
+template<typename Seq>
+struct make_variant;
+
+template<std::size_t... Is>
+struct make_variant<std::index_sequence<Is...> >
+{
+    using type = std::variant<Alt<Is>...>;
+};
+
+template<std::size_t N>
+using Wide = typename make_variant<std::make_index_sequence<N> >::type;
+
+/// Fill a variant with its alternative number Is.
+template<typename V, std::size_t... Is>
+V make(std::size_t alt, std::index_sequence<Is...>)
+{
+    V v;
+    ((alt == Is ? (v.template emplace<Is>(), true) : false) || ...);
+    return v;
+}
+
+/// Many variants, holding random alternatives.
+template<std::size_t N>
+std::vector<Wide<N> > values()
+{
+    std::mt19937 random(1);
+    std::vector<Wide<N> > vs;
+    for (auto i = 0; i < 4096; ++i) {
+        vs.push_back(make<Wide<N> >(random() % N, std::make_index_sequence<N>{}));
+    }
+    return vs;
+}
+
+/// A visitor which does a little work, different for each alternative.
+struct Work
+{
+    template<std::size_t I>
+    int operator()(const Alt<I> &a) const           { return a.value * (I % 7 + 1); }
+
+    template<std::size_t I, std::size_t J>
+    int operator()(const Alt<I> &a, const Alt<J> &b) const
+    {
+        return a.value * (J % 5 + 1) - b.value;
+    }
+};
+
+struct Std
+{
+    template<typename... Vs>
+    static int visit(const Vs &...vs)               { return std::visit(Work{}, vs...); }
+};
+
+struct Cbi
+{
+    template<typename... Vs>
+    static int visit(const Vs &...vs)               { return CompuBrite::visit(Work{}, vs...); }
+};
+
+template<typename Visit, std::size_t N>
+void BM_Visit(benchmark::State &state)
+{
+    auto vs = values<N>();
+    for (auto _ : state) {
+        int sum = 0;
+        for (auto &v : vs) {
+            sum += Visit::visit(v);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * vs.size());
+}
+BENCHMARK_TEMPLATE(BM_Visit, Std, 8);
+BENCHMARK_TEMPLATE(BM_Visit, Cbi, 8);
+BENCHMARK_TEMPLATE(BM_Visit, Std, 40);
+BENCHMARK_TEMPLATE(BM_Visit, Cbi, 40);
+BENCHMARK_TEMPLATE(BM_Visit, Std, 100);
+BENCHMARK_TEMPLATE(BM_Visit, Cbi, 100);
+
+/// Visit each pair of neighbouring variants.
+template<typename Visit, std::size_t N>
+void BM_Visit2(benchmark::State &state)
+{
+    auto vs = values<N>();
+    for (auto _ : state) {
+        int sum = 0;
+        for (std::size_t i = 1; i < vs.size(); ++i) {
+            sum += Visit::visit(vs[i - 1], vs[i]);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * (vs.size() - 1));
+}
+BENCHMARK_TEMPLATE(BM_Visit2, Std, 8);
+BENCHMARK_TEMPLATE(BM_Visit2, Cbi, 8);
+BENCHMARK_TEMPLATE(BM_Visit2, Std, 40);
+BENCHMARK_TEMPLATE(BM_Visit2, Cbi, 40);
+
+} // namespace
@@ -0,0 +1,102 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * @file
+ * @brief A compile-time benchmark for type_map: a map of CBI_ENTRIES
+ * entries, in which every key is looked up with CBI_LOOKUP, (find, has,
+ * index_of, or fold, which is a fold expression over the keys, as has()
+ * used to be).  It only needs compiling, e.g.
+ * @code
+ *    time g++ -std=c++17 -Iinclude -fsyntax-only -DCBI_ENTRIES=1000 \
+ *        -DCBI_LOOKUP=index_of bench/type_map_compile.cpp
+ * @endcode
+ * bench/type_map_compile.sh does so for 10, 100 and 1000 entries.
+*/
+
+#include "CompuBrite/type_map.h"
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#ifndef CBI_ENTRIES
+#define CBI_ENTRIES 100
+#endif
+
+#ifndef CBI_LOOKUP
+#define CBI_LOOKUP index_of
+#endif
+
+namespace {
+
+template<std::size_t I>
+struct Key { };
+
+template<std::size_t I>
+struct Value
+{
+    static constexpr std::size_t value = I;
+};
+
+template<typename Seq>
+struct make_map;
+
+template<std::size_t... Is>
+struct make_map<std::index_sequence<Is...> >
+{
+    using type = CompuBrite::type_map<CompuBrite::pair<Key<Is>, Value<Is> >...>;
+};
+
+using Map = make_map<std::make_index_sequence<CBI_ENTRIES> >::type;
+
+template<typename K, typename... elems>
+constexpr bool fold_has(CompuBrite::type_map<elems...> *)
+{
+    return (std::is_same_v<K, typename elems::first_type> || ...);
+}
+
+template<std::size_t I>
+constexpr std::size_t find()        { return Map::find<Key<I> >::value; }
+
+template<std::size_t I>
+constexpr std::size_t has()         { return Map::has<Key<I> >() ? I : 0; }
+
+template<std::size_t I>
+constexpr std::size_t index_of()    { return Map::index_of<Key<I> >; }
+
+template<std::size_t I>
+constexpr std::size_t fold()        { return fold_has<Key<I> >(static_cast<Map*>(nullptr)) ? I : 0; }
+
+template<std::size_t... Is>
+constexpr std::size_t lookups(std::index_sequence<Is...>)
+{
+    return (CBI_LOOKUP<Is>() + ... + 0);
+}
+
+static_assert(lookups(std::make_index_sequence<CBI_ENTRIES>{}) ==
+              CBI_ENTRIES * (CBI_ENTRIES - 1) / 2, "wrong lookup");
+
+} // namespace
+
+int main()
+{
+    return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Time compiling bench/type_map_compile.cpp for each lookup and map size.
+#
+#    bench/type_map_compile.sh [compiler]
+
+CXX=${1:-${CXX:-g++}}
+cd "$(dirname "$0")/.." || exit 1
+
+printf '%-10s %10s %10s %10s\n' lookup 10 100 1000
+for lookup in find has index_of fold; do
+    printf '%-10s' $lookup
+    for entries in 10 100 1000; do
+        start=$(date +%s.%N)
+        $CXX -std=c++17 -Iinclude -fsyntax-only -DCBI_ENTRIES=$entries \
+            -DCBI_LOOKUP=$lookup bench/type_map_compile.cpp || exit 1
+        end=$(date +%s.%N)
+        printf ' %9.2fs' "$(awk "BEGIN { print $end - $start }")"
+    done
+    printf '\n'
+done
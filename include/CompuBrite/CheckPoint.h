@@ -27,30 +27,106 @@
 #ifndef COMPUBRITE_CHECKPOINT_H_INCLUDED
 #define COMPUBRITE_CHECKPOINT_H_INCLUDED
 
-#include <unordered_set>
+#include <CompuBrite/string_record.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <istream>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <ostream>
 #include <iostream>
-#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 namespace CompuBrite {
 
 /// A ScopeGuard holds a functor which will be executed when it is destroyed,
-/// (goes out of scope).
+/// (goes out of scope), unless it has been dismissed.  The functor is held
+/// by value, so a ScopeGuard never allocates, and the call can be inlined.
+/// @par Example
+/// @code
+///     ScopeGuard guard([&]() { rollback(); });
+///     commit();
+///     guard.dismiss();
+/// @endcode
+/// @tparam Fn The functor type, (usually deduced).
+template <typename Fn>
 class ScopeGuard
 {
 public:
-    using FunctionType = std::function<void(void)>;
-
     /// Construct the ScopeGuard with the functor object.
-    ScopeGuard(FunctionType &&fn) : fn_{std::move(fn)} { }
+    explicit ScopeGuard(Fn fn) : fn_{std::move(fn)} { }
+
+    /// Take over other's functor, (other will no longer execute it).
+    ScopeGuard(ScopeGuard &&other) :
+        fn_{std::move(other.fn_)},
+        active_{other.active_}
+    {
+        other.dismiss();
+    }
+
+    ScopeGuard(const ScopeGuard&) = delete;
+    ScopeGuard& operator=(const ScopeGuard&) = delete;
+    ScopeGuard& operator=(ScopeGuard&&) = delete;
+
+    /// Destroy the ScopeGuard, execute the functor if not dismissed.
+    ~ScopeGuard()
+    {
+        if (active_) {
+            fn_();
+        }
+    }
+
+    /// Don't execute the functor after all.
+    void dismiss()                                     { active_ = false; }
 
-    /// Destroy the ScopeGuard, execute the functor.
-    ~ScopeGuard()                                      { fn_(); }
 private:
-    FunctionType fn_;
+    Fn fn_;
+    bool active_{true};
+};
+
+/// @return a ScopeGuard executing fn when it goes out of scope.
+template <typename Fn>
+ScopeGuard<std::decay_t<Fn>> make_scope_guard(Fn &&fn)
+{
+    return ScopeGuard<std::decay_t<Fn>>(std::forward<Fn>(fn));
+}
+
+namespace detail
+{
+
+/// The type of an argument in a binary trace record, (see
+/// CheckPoint::binary_output()).  Arithmetic values and pointers are
+/// recorded as their raw bytes; anything else is recorded as a String.
+enum class TraceTag : std::uint8_t
+{
+    Bool,
+    Char,
+    SChar,
+    UChar,
+    Short,
+    UShort,
+    Int,
+    UInt,
+    Long,
+    ULong,
+    LongLong,
+    ULongLong,
+    Float,
+    Double,
+    LongDouble,
+    Pointer,
+    String
 };
 
+} // namespace detail
+
 #ifdef CBI_CHECKPOINTS
 
 /// @brief A handy way of helping to describe the current source location.
@@ -61,6 +137,18 @@ private:
 /// CheckPoint::print().
 #define CBI_HERE CompuBrite::Here(__LINE__, __FILE__, __FUNCTION__)
 
+/// @brief A CheckPoint::Category for the given name, which is only looked up
+/// the first time this is reached, (it is kept in a static).
+/// @par Example
+/// @code
+///     CheckPoint dbg(CBI_CATEGORY("zork"));
+/// @endcode
+#define CBI_CATEGORY(name) \
+    ([]() -> const CompuBrite::CheckPoint::Category& { \
+        static const CompuBrite::CheckPoint::Category cbi_category(name); \
+        return cbi_category; \
+    }())
+
 /// @brief This class encapsulates the current source code location at runtime.
 class Here
 {
@@ -77,12 +165,119 @@ public:
         line_(line)
     { }
     ~Here() = default;
+
+    /// @return the source code filename.
+    const char *file() const                { return file_; }
+
+    /// @return the name of the function.
+    const char *function() const            { return func_; }
+
+    /// @return the source code line number.
+    size_t line() const                     { return line_; }
+
 private:
     const char * const file_;
     const char * const func_;
     const size_t       line_;
 };
 
+namespace detail
+{
+
+/// @return the tag for an argument of type T.
+template <typename T>
+constexpr TraceTag trace_tag()
+{
+    using U = std::remove_cv_t<T>;
+    if constexpr (std::is_same_v<U, bool>) {
+        return TraceTag::Bool;
+    } else if constexpr (std::is_same_v<U, char>) {
+        return TraceTag::Char;
+    } else if constexpr (std::is_same_v<U, signed char>) {
+        return TraceTag::SChar;
+    } else if constexpr (std::is_same_v<U, unsigned char>) {
+        return TraceTag::UChar;
+    } else if constexpr (std::is_same_v<U, short>) {
+        return TraceTag::Short;
+    } else if constexpr (std::is_same_v<U, unsigned short>) {
+        return TraceTag::UShort;
+    } else if constexpr (std::is_same_v<U, int>) {
+        return TraceTag::Int;
+    } else if constexpr (std::is_same_v<U, unsigned>) {
+        return TraceTag::UInt;
+    } else if constexpr (std::is_same_v<U, long>) {
+        return TraceTag::Long;
+    } else if constexpr (std::is_same_v<U, unsigned long>) {
+        return TraceTag::ULong;
+    } else if constexpr (std::is_same_v<U, long long>) {
+        return TraceTag::LongLong;
+    } else if constexpr (std::is_same_v<U, unsigned long long>) {
+        return TraceTag::ULongLong;
+    } else if constexpr (std::is_same_v<U, float>) {
+        return TraceTag::Float;
+    } else if constexpr (std::is_same_v<U, double>) {
+        return TraceTag::Double;
+    } else if constexpr (std::is_same_v<U, long double>) {
+        return TraceTag::LongDouble;
+    } else if constexpr (std::is_pointer_v<U> &&
+                         !std::is_same_v<std::remove_cv_t<std::remove_pointer_t<U>>, char>) {
+        return TraceTag::Pointer;
+    } else {
+        return TraceTag::String;
+    }
+}
+
+/// @return an argument as it is recorded: raw values as they are, strings
+/// as a view, and anything else formatted into a string.
+template <typename T>
+decltype(auto) trace_value(const T &value)
+{
+    if constexpr (trace_tag<T>() != TraceTag::String) {
+        return (value);
+    } else if constexpr (std::is_convertible_v<const T&, const char*>) {
+        const char *text = value;
+        return std::string_view(text ? text : "(null)");
+    } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+        return std::string_view(value);
+    } else {
+        std::ostringstream text;
+        text << value;
+        return text.str();
+    }
+}
+
+/// @return the bytes taken to record a value, (as returned by
+/// trace_value()).
+template <typename T>
+std::size_t trace_size(const T &value)
+{
+    if constexpr (trace_tag<T>() == TraceTag::String) {
+        return 1 + sizeof(std::uint32_t) + value.size();
+    } else {
+        return 1 + sizeof(T);
+    }
+}
+
+/// Record a value, (as returned by trace_value()), at p.
+/// @return the end of the recorded value.
+template <typename T>
+char *trace_put(char *p, const T &value)
+{
+    constexpr auto tag = trace_tag<T>();
+    *p++ = static_cast<char>(tag);
+    if constexpr (tag == TraceTag::String) {
+        auto size = static_cast<std::uint32_t>(value.size());
+        std::memcpy(p, &size, sizeof(size));
+        std::memcpy(p + sizeof(size), value.data(), size);
+        return p + sizeof(size) + size;
+    } else {
+        std::memcpy(p, &value, sizeof(T));
+        return p + sizeof(T);
+    }
+}
+
+} // namespace detail
+
 /// @brief Checkpoints are used to print out debugging or exception
 /// information.
 ///
@@ -120,19 +315,146 @@ private:
 /// @endcode
 /// This will enable categories "foo" and "bar", but disable category "zork",
 /// and will make all exceptions fatal.
+///
+/// Each message is formatted into a buffer for the calling thread, and then
+/// written out whole, so that messages from different threads don't
+/// interleave.  The "async" directive, (or async_output()), hands messages
+/// for std::cerr to a background thread instead, which writes them out in
+/// batches, so that the calling thread doesn't wait for the write.
+///
+/// The "binary" directive, (or binary_output()), goes further: print()
+/// only copies the arguments' bytes into a ring buffer for the calling
+/// thread, and they are formatted later, by a background thread, or by
+/// decode() from a trace file, (see the cbi_trace tool).
 /// @par Example
 /// @include test.cpp
 class CheckPoint
 {
 public:
+    /// @brief A CheckPoint category, which is recorded once, and referred
+    /// to by a small integer from then on.
+    ///
+    /// Constructing a CheckPoint from a Category which has already been made
+    /// doesn't need to look up its name, so one may be kept in a static,
+    /// where CheckPoints are made in a loop.
+    /// @par Example
+    /// @code
+    ///     static const CheckPoint::Category zork("zork");
+    ///     for (auto &item : items) {
+    ///         CheckPoint(zork).print(CBI_HERE, "item = ", item);
+    ///     }
+    /// @endcode
+    /// @see CBI_CATEGORY
+    class Category
+    {
+    public:
+        Category(const char *name);
+        Category(const std::string &name)  : Category(name.c_str()) { }
+
+        /// @return the number by which this Category is known.
+        size_t id() const                   { return record_.index(); }
+
+        /// @return the name of this Category.
+        std::string_view name() const       { return record_.string_view(); }
+
+    private:
+        string_record record_;
+    };
+
+    /// @brief A call site made by CBI_PRINT(), CBI_HIT() or CBI_EXPECT().
+    ///
+    /// Each site keeps its own flag, which is updated whenever the
+    /// configuration changes, (like the kernel's dynamic debug), so a
+    /// disabled site costs one load and a predicted branch.  A site has a
+    /// constexpr constructor, so a static one needs no guard either.  A site
+    /// works out its flag, (and is linked into the list of sites), the first
+    /// time it is reached.
+    class Site
+    {
+    public:
+        /// @param category The category, or nullptr for an exception site,
+        /// (which is only controlled by "expect-off").
+        constexpr explicit Site(const char *category) : category_(category) { }
+
+        Site(const Site&) = delete;
+        Site& operator=(const Site&) = delete;
+
+        /// @return true if this site is enabled.
+        bool on()
+        {
+            auto state = state_.load(std::memory_order_acquire);
+            return state != Off && (state == On || check());
+        }
+
+        /// Print a debugging message for this site's category.
+        template <typename ...Args>
+        void print(const Here& here, const Args& ...args)
+        {
+            if (binary_.load(std::memory_order_relaxed)) {
+                trace(here, category_, args...);
+                return;
+            }
+            out(here, std::cerr, category_, args...);
+        }
+
+        /// Print an exception message, then trap, (as for hit()).
+        template <typename ...Args>
+        void raise(const Here& here, std::string_view reason, const Args& ...args)
+        {
+            out(here, std::cerr, reason, args...);
+            trap(here);
+        }
+
+    private:
+        friend class CheckPoint;
+
+        enum State : std::uint8_t
+        {
+            Off,
+            On,
+            Unknown
+        };
+
+        /// Work out the flag, (linking this site in, the first time).
+        /// @return true if this site is enabled.
+        bool check();
+
+        /// @return true if the configuration enables this site.
+        bool wanted() const;
+
+        const char *category_;
+        size_t id_{0};
+        bool linked_{false};
+        std::atomic<std::uint8_t> state_{Unknown};
+        Site *next_{nullptr};
+    };
+
+    /// @return true if name is one of list.  This is used by
+    /// CBI_CATEGORY_ALLOWED(), for the compile-time list of categories.
+    static constexpr bool listed(std::string_view name,
+                                 std::initializer_list<std::string_view> list)
+    {
+        for (auto allowed : list) {
+            if (allowed == name) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     /// @brief Construct a Checkpoint.
-    /// @param category The category name for this checkpoint.  This CheckPoint
+    /// @param category The category for this checkpoint.  This CheckPoint
     /// will only function if this category has been enabled.
     /// @param out_ The output stream to write CheckPoint messages to.
-    explicit CheckPoint(std::string &&category, std::ostream& out_ = std::cerr);
+    explicit CheckPoint(Category category, std::ostream& out_ = std::cerr);
     ~CheckPoint() = default;
-    CheckPoint(const CheckPoint&) = default;
-    CheckPoint(CheckPoint&&) = default;
+    CheckPoint(const CheckPoint &other) :
+        category_(other.category_),
+        out_(other.out_),
+        state_(other.state_.load(std::memory_order_relaxed))
+    { }
+    CheckPoint(CheckPoint &&other) : CheckPoint(other)
+    { }
 
     CheckPoint& operator=(const CheckPoint&) = default;
     CheckPoint& operator=(CheckPoint&&) = default;
@@ -170,10 +492,10 @@ public:
     template <typename ...Args>
     static void hit(const Here& here, const Args& ...args)
     {
-        if (!init_) {
+        if (!init_.load(std::memory_order_acquire)) {
             init();
         }
-        if (disabled_) {
+        if (disabled_.load(std::memory_order_relaxed)) {
             return;
         }
         out(here, std::cerr, "Exception", args...);
@@ -207,10 +529,10 @@ public:
     template <typename Cond, typename ...Args>
     static Cond expect(const Here& here, Cond &&cond, const Args& ...args)
     {
-        if (!init_) {
+        if (!init_.load(std::memory_order_acquire)) {
             init();
         }
-        if (!disabled_ && !static_cast<bool>(cond)) {
+        if (!disabled_.load(std::memory_order_relaxed) && !static_cast<bool>(cond)) {
             out(here, std::cerr, "Expectation failed", args...);
             trap(here);
         }
@@ -227,7 +549,11 @@ public:
     /// the condition is false, and exception CheckPoints are enabled, then
     /// the arguments will be printed after a brief message explaining the
     /// exception and source location.
-    /// @param args Arguments to be printed if "cond" is false
+    /// @param args Arguments to be printed if "cond" is false.  Arguments
+    /// which are lvalues are held by reference, (so they are printed as they
+    /// are when the scope ends), while temporaries, (such as std::ref(j)), are
+    /// moved into the guard.  Nothing is allocated.
+    /// @return A guard which checks the condition when it is destroyed.
     /// @par Example
     /// You can check if a post condition is false at scope termination
     /// as follows:
@@ -239,21 +565,21 @@ public:
     /// }
     /// @endcode
     template <typename Cond, typename ...Args>
-    static ScopeGuard ensure(const Here& here,
-                             const Cond &cond,
-                             const Args& ...args)
+    static auto ensure(const Here& here, Cond &&cond, Args&& ...args)
     {
-        if (!init) {
+        if (!init_.load(std::memory_order_acquire)) {
             init();
         }
-        auto tup = std::make_tuple(args...);
-        auto f = [here, cond, tup]() {
-           if (!disabled_ && !cond()) {
-               out(here, std::cerr, "Invariant", tup);
-               trap(here);
-           }
-        };
-        return ScopeGuard(std::move(f));
+        return make_scope_guard(
+            [here, cond = std::forward<Cond>(cond),
+             tup = std::tuple<Args...>(std::forward<Args>(args)...)]() {
+                if (!disabled_.load(std::memory_order_relaxed) && !cond()) {
+                    std::apply([&here](const auto& ...a) {
+                        out(here, std::cerr, "Invariant", a...);
+                    }, tup);
+                    trap(here);
+                }
+            });
     }
 
     /// @brief Used to print a debugging message in an active debug CheckPoint
@@ -286,10 +612,14 @@ public:
     template <typename ...Args>
     void print(const Here& here, const Args& ...args)
     {
-        if (!active_) {
+        if (!active()) {
+            return;
+        }
+        if (binary_.load(std::memory_order_relaxed) && &out_ == &std::cerr) {
+            trace(here, category_.name(), args...);
             return;
         }
-        out(here, out_, category_, args...);
+        out(here, out_, category_.name(), args...);
     }
 
     /// @brief Is this debugging CheckPoint active?
@@ -313,7 +643,22 @@ public:
     /// resume execution.  In release mode, (where the CBI_CHECKPOINT macro
     /// is not defined), active() return false; the compiler will optimize
     /// the entire if statement away, cleanly.
-    bool active() const                { return active_ && !disabled_; }
+    /// @note
+    /// Categories may be enabled and disabled at run time, (see enable()),
+    /// which bumps a generation count.  A CheckPoint only looks at its
+    /// category again if the generation has changed.  The generation it
+    /// last saw and the answer are kept together in one atomic word, so
+    /// a CheckPoint may be shared between threads.
+    bool active() const
+    {
+        auto generation = generation_.load(std::memory_order_acquire);
+        auto state = state_.load(std::memory_order_relaxed);
+        if ((state >> 1) != generation) {
+            state = (generation << 1) | (enabled(category_.id()) ? 1 : 0);
+            state_.store(state, std::memory_order_relaxed);
+        }
+        return (state & 1) && !disabled_.load(std::memory_order_relaxed);
+    }
 
 
     /// Programatically enable a specific category.  Usually this would
@@ -327,36 +672,178 @@ public:
     /// disabled.
     /// @param category The category to disable.
     static void disable(const char *category);
+
+    /// Turn asynchronous output on or off.  While it is on, messages for
+    /// std::cerr are queued for a background thread to write, (messages
+    /// for other streams are still written by the calling thread).  Turning
+    /// it off waits for the messages already queued to be written.
+    /// @param on true to turn asynchronous output on.
+    static void async_output(bool on);
+
+    /// Wait until every message queued for asynchronous output so far has
+    /// been written.  This is done before an exception CheckPoint traps,
+    /// (so a fatal exception's message isn't lost).
+    static void flush();
+
+    /// Replace the configuration with a new list of categories and
+    /// directives, (as for the CBI_CHECKPOINTS environment variable).  This
+    /// may be called at any time, from any thread, and existing CheckPoints
+    /// follow the new configuration.
+    /// @param spec The new list, or nullptr to read CBI_CHECKPOINTS again.
+    static void reload(const char *spec = nullptr);
+
+    /// Reload the configuration whenever the process receives the given
+    /// signal, (e.g. `kill -USR1 <pid>`), so that tracing may be turned on
+    /// in a running process.  The signal handler only marks the
+    /// configuration as stale; it is reloaded by the next CheckPoint to look
+    /// at it.
+    /// @param signal The signal, (e.g. SIGUSR1).
+    /// @param path If not empty, a file to read the new list from, (since
+    /// the process's environment can't be changed from outside), otherwise
+    /// CBI_CHECKPOINTS is read again.
+    static void reload_on_signal(int signal, const std::string &path = std::string());
+
+    /// Turn binary tracing on or off.  While it is on, print() for
+    /// std::cerr records the source location, a timestamp, and the raw bytes
+    /// of its arguments, (strings are copied, and other types are formatted
+    /// as they are now), into a ring buffer for the calling thread, rather
+    /// than formatting the message.  A background thread takes the records
+    /// from the ring buffers, (if one is full, records are dropped, and the
+    /// number dropped is reported).
+    /// @param on true to turn binary tracing on.
+    /// @param path If not empty, the records are written to this file, to be
+    /// decoded later, (see decode()), otherwise the background thread
+    /// formats them to std::cerr.
+    static void binary_output(bool on, const std::string &path = std::string());
+
+    /// Decode a trace file, (written by binary_output()), into text.
+    /// @param in The trace.
+    /// @param out The stream to write the messages to.
+    /// @return false if in isn't a trace, or is truncated.
+    static bool decode(std::istream &in, std::ostream &out);
+
+    /// @brief Start timing a scope, (this is used by CBI_TIMED()).
+    /// If the site's category is enabled, the time until the returned guard
+    /// is destroyed is recorded in a histogram for the category, (kept for
+    /// each thread, so recording never contends).
+    /// @tparam Allowed false if the category was left out at compile time,
+    /// (see CBI_CATEGORY_ALLOWED()), in which case nothing is timed.
+    /// @param site The call site.
+    /// @return A guard which records the time when it is destroyed.
+    template <bool Allowed = true>
+    static auto timed(Site &site)
+    {
+        using Clock = std::chrono::steady_clock;
+        if constexpr (Allowed) {
+            auto start = site.on() ? Clock::now() : Clock::time_point();
+            return make_scope_guard([&site, start]() {
+                if (start != Clock::time_point()) {
+                    timing(site, Clock::now() - start);
+                }
+            });
+        } else {
+            return make_scope_guard([]() { });
+        }
+    }
+
+    /// Print the percentiles of the times recorded by CBI_TIMED() for each
+    /// category, (for every thread, including those which have exited).
+    /// @param os The stream to print to.
+    static void dump_timings(std::ostream &os = std::cerr);
 private:
     static void init();
-    static bool active(const std::string &category);
+
+    /// Apply a list of categories and directives.
+    static void apply(const std::string &spec);
+
+    /// @return true if the category with the given id is enabled, (after
+    /// any pending reload).
+    static bool enabled(size_t id);
+
+    /// @return true if the category with the given id is enabled.
+    static bool lookup(size_t id);
+
+    /// Do the reload asked for by the signal handler, if any.
+    static void pending();
+
+    /// Update the flag of every Site from the configuration.
+    static void refresh();
 
     template <typename ...Args>
     static void out(const Here &here,
                     std::ostream& os,
-                    const std::string &reason, const Args& ...args)
+                    std::string_view reason, const Args& ...args)
     {
-        os << "@@@ CheckPoint (" << reason << "): " << here << "\n@@@ ";
-        (os << ... << args);
-        os << std::endl;
+        auto &rec = record();
+        rec << "@@@ CheckPoint (" << reason << "): " << here << "\n@@@ ";
+        (rec << ... << args);
+        rec << '\n';
+        emit(os);
     }
 
+    /// @return a stream which formats into an empty buffer for the calling
+    /// thread.
+    static std::ostream& record();
+
+    /// Write out the calling thread's buffer, (as filled via record()), to
+    /// os, or queue it to be written.
+    static void emit(std::ostream &os);
+
     static void trap(const Here& here);
 
+    /// Record a message into the calling thread's trace ring buffer.
+    template <typename ...Args>
+    static void trace(const Here &here, std::string_view category,
+                      const Args& ...args)
+    {
+        traceValues(here, category, detail::trace_value(args)...);
+    }
+
+    template <typename ...Values>
+    static void traceValues(const Here &here, std::string_view category,
+                            const Values& ...values)
+    {
+        auto p = traceBegin(here, category,
+                            (detail::trace_size(values) + ... + 0));
+        if (p) {
+            ((p = detail::trace_put(p, values)), ...);
+            traceCommit();
+        }
+    }
+
+    /// Reserve a record, and fill in its header.
+    /// @return where the values go, or nullptr if the ring buffer is full.
+    static char *traceBegin(const Here &here, std::string_view category,
+                            size_t size);
+
+    /// Publish the record reserved by traceBegin().
+    static void traceCommit();
+
+    /// Record the time taken by a CBI_TIMED() scope.
+    static void timing(const Site &site, std::chrono::steady_clock::duration elapsed);
+
 private:
-    bool active_{false};
-    std::string category_;
+    /// The most categories which may be enabled individually, (any more
+    /// are only enabled by "all").
+    static constexpr size_t MaxCategories = 4096;
+
+    Category category_;
     std::ostream &out_;
+    /// The generation last seen, shifted left by one, with the category's
+    /// state in the low bit.
+    mutable std::atomic<std::uint64_t> state_{0};
 
-    static bool init_;
-    static bool all_;
-    static bool disabled_;
-    static std::unordered_set<std::string> categories_;
-    static std::function<void()> trap_;
+    static std::atomic<bool> init_;
+    static std::atomic<bool> all_;
+    static std::atomic<bool> disabled_;
+    static std::atomic<bool> binary_;
+    static std::atomic<std::uint64_t> generation_;
+    static std::atomic<std::uint64_t> categories_[MaxCategories / 64];
 };
 #else // !CBI_CHECKPOINTS
 
 #define CBI_HERE CompuBrite::Here()
+#define CBI_CATEGORY(name) (name)
 class Here
 {
 public:
@@ -366,7 +853,14 @@ public:
 class CheckPoint
 {
 public:
-    CheckPoint(const std::string&, std::ostream& = std::cerr) { }
+    class Category
+    {
+    public:
+        Category(const char *) { }
+        Category(const std::string &) { }
+    };
+
+    CheckPoint(const Category&, std::ostream& = std::cerr) { }
     ~CheckPoint() = default;
     CheckPoint(const CheckPoint&) = default;
     CheckPoint(CheckPoint&&) = default;
@@ -405,6 +899,32 @@ public:
     static void disable(const char *)
     {
     }
+
+    static void async_output(bool)
+    {
+    }
+
+    static void flush()
+    {
+    }
+
+    static void reload(const char * = nullptr)
+    {
+    }
+
+    static void reload_on_signal(int, const std::string & = std::string())
+    {
+    }
+
+    static void binary_output(bool, const std::string & = std::string())
+    {
+    }
+
+    static bool decode(std::istream &in, std::ostream &out);
+
+    static void dump_timings(std::ostream & = std::cerr)
+    {
+    }
 };
 #endif // CBI_CHECKPOINTS
 
@@ -434,5 +954,88 @@ std::ostream &operator<<(std::ostream& os, const std::tuple<Args...> &t)
     auto CBI_ANONYMOUS_VARIABLE(cbi_guard_) = CompuBrite::CheckPoint::ensure(here, \
     [&]() { return cond; }, Args);
 
+/// @brief true if the category, (a string literal), may be used by
+/// CBI_PRINT().
+///
+/// If CBI_CHECKPOINT_CATEGORIES is defined, (as a list of string literals,
+/// e.g. -DCBI_CHECKPOINT_CATEGORIES='"net","db"'), only the categories in it
+/// are compiled in, and CBI_PRINT() for any other category vanishes, (even
+/// when CBI_CHECKPOINTS is defined).
+#ifdef CBI_CHECKPOINT_CATEGORIES
+#define CBI_CATEGORY_ALLOWED(name) \
+    CompuBrite::CheckPoint::listed(name, {CBI_CHECKPOINT_CATEGORIES})
+#else
+#define CBI_CATEGORY_ALLOWED(name) true
+#endif
+
+#ifdef CBI_CHECKPOINTS
+
+/// @brief Print a debugging message if the category is enabled.
+///
+/// This is the same as CheckPoint(category).print(CBI_HERE, args...), but
+/// the call site keeps its own flag, (see CheckPoint::Site), and the
+/// arguments are only evaluated if the message is printed.
+/// @par Example
+/// @code
+///     CBI_PRINT("zork", "state = ", state);
+/// @endcode
+#define CBI_PRINT(category, Args...) \
+    do { \
+        if constexpr (CBI_CATEGORY_ALLOWED(category)) { \
+            static CompuBrite::CheckPoint::Site cbi_site(category); \
+            if (__builtin_expect(cbi_site.on(), 0)) { \
+                cbi_site.print(CBI_HERE, ## Args); \
+            } \
+        } \
+    } while (false)
+
+/// @brief An exception CheckPoint, (as for CheckPoint::hit()), with its own
+/// flag.
+#define CBI_HIT(Args...) \
+    do { \
+        static CompuBrite::CheckPoint::Site cbi_site(nullptr); \
+        if (cbi_site.on()) { \
+            cbi_site.raise(CBI_HERE, "Exception", ## Args); \
+        } \
+    } while (false)
+
+/// @brief An exception CheckPoint for an assertion, (as for
+/// CheckPoint::expect()), with its own flag.  The condition is always
+/// evaluated, and the arguments only if it is false.
+#define CBI_EXPECT(cond, Args...) \
+    do { \
+        static CompuBrite::CheckPoint::Site cbi_site(nullptr); \
+        if (__builtin_expect(!static_cast<bool>(cond), 0) && cbi_site.on()) { \
+            cbi_site.raise(CBI_HERE, "Expectation failed", ## Args); \
+        } \
+    } while (false)
+
+/// @brief Time the rest of the enclosing scope, if the category is enabled.
+///
+/// The times are kept in a histogram for each category, (see
+/// CheckPoint::dump_timings()).
+/// @par Example
+/// @code
+///     void lookup()
+///     {
+///         CBI_TIMED("lookup");
+///         ...
+///     }
+/// @endcode
+#define CBI_TIMED(category) \
+    static CompuBrite::CheckPoint::Site CBI_ANONYMOUS_VARIABLE(cbi_timed_site_)(category); \
+    auto CBI_ANONYMOUS_VARIABLE(cbi_timed_) = \
+        CompuBrite::CheckPoint::timed<CBI_CATEGORY_ALLOWED(category)>( \
+            CBI_ANONYMOUS_VARIABLE(cbi_timed_site_))
+
+#else // !CBI_CHECKPOINTS
+
+#define CBI_PRINT(category, Args...) do { } while (false)
+#define CBI_HIT(Args...) do { } while (false)
+#define CBI_EXPECT(cond, Args...) do { static_cast<void>(cond); } while (false)
+#define CBI_TIMED(category) do { } while (false)
+
+#endif // CBI_CHECKPOINTS
+
 
 #endif // COMPUBRITE_CHECKPOINT_H_INCLUDED
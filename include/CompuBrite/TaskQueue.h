@@ -27,45 +27,164 @@
 #ifndef COMPUBRITE_TASKQUEUE_H_INCLUDED
 #define COMPUBRITE_TASKQUEUE_H_INCLUDED
 
-#include <functional>
-#include <list>
+#include <CompuBrite/header_only.h>
+#include <CompuBrite/inplace_task.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// The inline capacity, in bytes, of a TaskQueue::Task.  Tasks whose
+/// captures fit in this many bytes never allocate.  This may be overridden
+/// on the command line, but it must then be the same for the library and
+/// for all of its clients.
+#ifndef CBI_TASK_SIZE
+#define CBI_TASK_SIZE 64
+#endif
+
+// If CBI_POOL_STATS is defined, TaskQueue records the time at which each
+// task was added, and ThreadPool keeps statistics, (see ThreadPool::stats()).
+// Like CBI_TASK_SIZE, it must be the same for the library and all of its
+// clients.
 
 namespace CompuBrite
 {
 
 /**
- * TaskQueue holds a list of std::function, (Task), objects and allows clients
- * to add new tasks to the back of the queue, and take tasks from the front.
+ * TaskQueue holds a list of move-only Task objects and allows clients
+ * to add new tasks to the queue, and take tasks from it.  The Order of the
+ * queue decides which task is taken next: the oldest, (FIFO), the newest,
+ * (LIFO), or the one with the highest priority.
+ *
+ * The tasks are stored in a contiguous ring buffer.  An unbounded TaskQueue
+ * doubles the ring when it fills up, and never shrinks it, so once it has
+ * reached its working size, adding a task doesn't allocate.  A bounded
+ * TaskQueue allocates its ring up front, and refuses new tasks when full.
  */
 class TaskQueue
 {
 public:
-    using Task = std::function<void(void)>;
-    using Queue = std::list<Task>;
+    using Task = inplace_task<CBI_TASK_SIZE>;
+    using Ring = std::vector<Task>;
+    using Clock = std::chrono::steady_clock;
+
+    /// Tasks with a higher Priority are taken first.
+    using Priority = std::int64_t;
+
+    /// The order in which tasks are taken from the queue.
+    enum class Order
+    {
+        FIFO,       ///< Oldest first, for fairness.
+        LIFO,       ///< Newest first, for cache warmth.
+        Priority    ///< Highest priority first, then oldest first.
+    };
 
-    TaskQueue() = default;
+    /// Construct a TaskQueue.
+    /// @param capacity The maximum number of tasks the queue may hold, or
+    /// 0 for no limit.
+    /// @param order The order in which tasks are taken from the queue.
+    explicit TaskQueue(std::size_t capacity = 0, Order order = Order::FIFO);
     ~TaskQueue() = default;
 
     TaskQueue(const TaskQueue&) = delete;
     TaskQueue& operator=(const TaskQueue&) = delete;
 
     /// Add a new task to the queue.
-    void add(Task task);
+    /// @param task The task to add.
+    /// @param priority The priority of the task.  This is ignored unless
+    /// the Order is Order::Priority.
+    /// @return false if the queue is full, in which case the task is left
+    /// untouched.
+    bool add(Task &&task, Priority priority = 0);
 
     /// Take a task from the queue, if possible.
-    /// @return an empty std::function if no task is available, otherwise
-    /// the task at the back of the queue.
+    /// @return an empty Task if no task is available, otherwise
+    /// the next task according to the Order of the queue.
     Task take();
 
+#ifdef CBI_POOL_STATS
+    /// Take a task from the queue, if possible, along with the time at
+    /// which it was added.
+    /// @overload
+    Task take(Clock::time_point &queued);
+#endif
+
+    /// @return a Priority for a task which should be run by the given
+    /// deadline.  Earlier deadlines have higher priorities.   These are
+    /// only comparable with each other, so deadlines and other priorities
+    /// shouldn't be mixed in the same queue.
+    static Priority deadline(Clock::time_point when)
+    {
+        return -static_cast<Priority>(when.time_since_epoch().count());
+    }
+
+    /// @return the Order of the TaskQueue.
+    Order order() const           { return _order; }
+
     /// @return true if the TaskQueue is empty.
-    bool empty()                  { return _queue.empty(); }
+    bool empty() const            { return _size == 0; }
+
+    /// @return true if the TaskQueue is bounded and holds capacity() tasks.
+    bool full() const             { return _capacity && _size == _capacity; }
+
+    /// @return the number of tasks in the queue.
+    std::size_t size() const      { return _size; }
+
+    /// @return the maximum number of tasks the queue may hold, or 0 if
+    /// there is no limit.
+    std::size_t capacity() const  { return _capacity; }
+
+private:
+    /// A task in the priority heap.  Among tasks of equal priority, the
+    /// one with the lowest sequence, (the oldest), is taken first.
+    struct Entry
+    {
+        Priority        priority;
+        std::uint64_t   sequence;
+        Task            task;
+#ifdef CBI_POOL_STATS
+        Clock::time_point   queued;
+#endif
+
+        bool operator<(const Entry &rhs) const
+        {
+            return priority < rhs.priority ||
+                (priority == rhs.priority && sequence > rhs.sequence);
+        }
+    };
+    using Heap = std::vector<Entry>;
+
+    /// @return the slot for the i'th task from the front of the queue.
+    Task& at(std::size_t i)       { return _ring[(_head + i) & (_ring.size() - 1)]; }
+
+    /// Double the size of the ring, (which must be full).
+    void grow();
+
+    /// Take a task from the queue, if possible.
+    /// @param queued If not null, (and CBI_POOL_STATS is defined), this is
+    /// set to the time at which the task was added.
+    Task pop(Clock::time_point *queued);
 
 private:
-    Queue                   _queue;
+    Ring                    _ring;
+#ifdef CBI_POOL_STATS
+    std::vector<Clock::time_point> _stamps;
+#endif
+    Heap                    _heap;
+    std::size_t             _head{0};
+    std::size_t             _size{0};
+    std::size_t             _capacity{0};
+    std::uint64_t           _sequence{0};
+    Order                   _order{Order::FIFO};
 };
 
 TaskQueue&
-operator<<(TaskQueue &queue, TaskQueue::Task task);
+operator<<(TaskQueue &queue, TaskQueue::Task &&task);
 
 } // namespace CompuBrite
+
+#ifdef CBI_HEADER_ONLY
+#include <CompuBrite/TaskQueue.ipp>
+#endif
+
 #endif // COMPUBRITE_TASKQUEUE_H_INCLUDED
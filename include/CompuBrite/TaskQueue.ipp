@@ -0,0 +1,173 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief Implementation for TaskQueue.  This is compiled into the library
+ * by TaskQueue.cpp, or included by TaskQueue.h if CBI_HEADER_ONLY is
+ * defined.
+*/
+
+#ifndef COMPUBRITE_TASKQUEUE_IPP_INCLUDED
+#define COMPUBRITE_TASKQUEUE_IPP_INCLUDED
+
+#include <CompuBrite/TaskQueue.h>
+
+#include <algorithm>
+
+namespace CompuBrite {
+
+namespace detail {
+
+/// @return the smallest power of two which is at least n.
+CBI_INLINE std::size_t
+roundUp(std::size_t n)
+{
+    std::size_t r = 1;
+    while (r < n) {
+        r <<= 1;
+    }
+    return r;
+}
+
+} // namespace detail
+
+CBI_INLINE
+TaskQueue::TaskQueue(std::size_t capacity, Order order) :
+    _capacity(capacity),
+    _order(order)
+{
+    if (!_capacity) {
+        return;
+    }
+    if (_order == Order::Priority) {
+        _heap.reserve(_capacity);
+    } else {
+        _ring.resize(detail::roundUp(_capacity));
+#ifdef CBI_POOL_STATS
+        _stamps.resize(_ring.size());
+#endif
+    }
+}
+
+CBI_INLINE bool
+TaskQueue::add(TaskQueue::Task &&task, Priority priority)
+{
+    if (full()) {
+        return false;
+    }
+    if (_order == Order::Priority) {
+        _heap.push_back(Entry{priority, _sequence++, std::move(task)});
+#ifdef CBI_POOL_STATS
+        _heap.back().queued = Clock::now();
+#endif
+        std::push_heap(_heap.begin(), _heap.end());
+    } else {
+        if (_size == _ring.size()) {
+            grow();
+        }
+        at(_size) = std::move(task);
+#ifdef CBI_POOL_STATS
+        _stamps[(_head + _size) & (_ring.size() - 1)] = Clock::now();
+#endif
+    }
+    ++_size;
+    return true;
+}
+
+CBI_INLINE TaskQueue::Task
+TaskQueue::take()
+{
+    return pop(nullptr);
+}
+
+#ifdef CBI_POOL_STATS
+CBI_INLINE TaskQueue::Task
+TaskQueue::take(Clock::time_point &queued)
+{
+    return pop(&queued);
+}
+#endif
+
+CBI_INLINE TaskQueue::Task
+TaskQueue::pop(Clock::time_point *queued)
+{
+    if (empty()) {
+        return Task();
+    }
+    --_size;
+    std::size_t slot = 0;
+    switch (_order) {
+    case Order::FIFO:
+        slot = _head;
+        _head = (_head + 1) & (_ring.size() - 1);
+        break;
+    case Order::LIFO:
+        slot = (_head + _size) & (_ring.size() - 1);
+        break;
+    case Order::Priority: {
+        std::pop_heap(_heap.begin(), _heap.end());
+        auto task = std::move(_heap.back().task);
+#ifdef CBI_POOL_STATS
+        if (queued) {
+            *queued = _heap.back().queued;
+        }
+#endif
+        _heap.pop_back();
+        return task;
+    }
+    }
+#ifdef CBI_POOL_STATS
+    if (queued) {
+        *queued = _stamps[slot];
+    }
+#endif
+    (void)queued;
+    return std::move(_ring[slot]);
+}
+
+CBI_INLINE void
+TaskQueue::grow()
+{
+    Ring ring(_ring.empty() ? 16 : _ring.size() * 2);
+    for (auto i = 0u; i < _size; ++i) {
+        ring[i] = std::move(at(i));
+    }
+#ifdef CBI_POOL_STATS
+    std::vector<Clock::time_point> stamps(ring.size());
+    for (auto i = 0u; i < _size; ++i) {
+        stamps[i] = _stamps[(_head + i) & (_ring.size() - 1)];
+    }
+    _stamps.swap(stamps);
+#endif
+    _ring.swap(ring);
+    _head = 0;
+}
+
+CBI_INLINE TaskQueue&
+operator<<(TaskQueue &queue, TaskQueue::Task &&task)
+{
+    queue.add(std::move(task));
+    return queue;
+}
+
+} // namespace CompuBrite
+#endif // COMPUBRITE_TASKQUEUE_IPP_INCLUDED
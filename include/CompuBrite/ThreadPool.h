@@ -28,23 +28,167 @@
 #define COMPUBRITE_THREADPOOL_H_INCLUDED
 
 #include <CompuBrite/TaskQueue.h>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <future>
+#include <iterator>
+#include <list>
+#include <tuple>
+#include <type_traits>
+#include <memory>
+#include <vector>
 
 namespace CompuBrite
 {
 
 /**
  * Manage a pool of threads and tasks for the threads to perform.
+ *
+ * By default, all threads share a single TaskQueue.  A pool constructed
+ * with Scheduling::WorkStealing instead gives each thread its own lock-free
+ * deque.  Tasks added from within one of the pool's threads go onto that
+ * thread's deque, tasks added from any other thread go onto the shared
+ * TaskQueue, and idle threads steal work from each other before looking at
+ * the shared TaskQueue.
  */
 class ThreadPool
 {
 public:
-    using Task = TaskQueue::Task;
+    using Task     = TaskQueue::Task;
+    using Order    = TaskQueue::Order;
+    using Priority = TaskQueue::Priority;
+
+    /// How shutdown() treats the tasks which are still waiting to run.
+    enum class Mode
+    {
+        Drain,          ///< Run them all first.
+        Immediate       ///< Drop them, and hand them back.
+    };
+
+    /// How an idle thread waits for work.  It first polls for work spins
+    /// times, pausing the CPU between polls, then polls yields times,
+    /// yielding the CPU between polls, and finally goes to sleep until it is
+    /// woken.  Spinning cuts the latency of picking up a new task, at the
+    /// cost of burning CPU while idle.
+    struct IdlePolicy
+    {
+        std::size_t spins{0};
+        std::size_t yields{0};
+
+        /// @return a policy which goes straight to sleep, (the default).
+        /// This suits pools which run long or batch tasks.
+        static IdlePolicy sleeping()        { return IdlePolicy{0, 0}; }
+
+        /// @return a policy which spins for a while before sleeping.  This
+        /// suits pools which run latency critical, microsecond scale tasks,
+        /// on machines with more cores than busy threads.
+        static IdlePolicy spinning()        { return IdlePolicy{4096, 64}; }
+    };
+
+    /// A snapshot of the statistics for a pool.  These are only kept if
+    /// CBI_POOL_STATS is defined, (otherwise, stats() returns an empty
+    /// snapshot, and the pool does no extra work at all).
+    struct Stats
+    {
+        /// true if the statistics are being kept.
+#ifdef CBI_POOL_STATS
+        static constexpr bool enabled = true;
+#else
+        static constexpr bool enabled = false;
+#endif
+
+        /// A histogram of durations, with a bucket for each power of two
+        /// nanoseconds.  Bucket i counts durations in [2^i, 2^(i+1)) ns,
+        /// (bucket 0 also counts anything shorter).
+        struct Histogram
+        {
+            static constexpr std::size_t Buckets = 40;
+            std::array<std::uint64_t, Buckets> counts{};
+
+            /// @return the number of durations recorded.
+            std::uint64_t total() const
+            {
+                std::uint64_t n = 0;
+                for (auto c : counts) {
+                    n += c;
+                }
+                return n;
+            }
+
+            /// @return an upper bound for the given percentile, (0 to 100),
+            /// of the recorded durations.
+            std::chrono::nanoseconds percentile(double p) const
+            {
+                auto want = static_cast<std::uint64_t>(total() * p / 100.0);
+                std::uint64_t n = 0;
+                for (auto i = 0u; i < Buckets; ++i) {
+                    n += counts[i];
+                    if (n > want || (n == want && n == total())) {
+                        return std::chrono::nanoseconds(std::int64_t{2} << i);
+                    }
+                }
+                return std::chrono::nanoseconds(0);
+            }
+
+            Histogram& operator+=(const Histogram &rhs)
+            {
+                for (auto i = 0u; i < Buckets; ++i) {
+                    counts[i] += rhs.counts[i];
+                }
+                return *this;
+            }
+        };
+
+        /// The counters for a single thread.
+        struct Thread
+        {
+            std::uint64_t   tasks{0};       ///< Tasks run.
+            std::uint64_t   steals{0};      ///< Tasks stolen from other threads.
+            std::uint64_t   wakeups{0};     ///< Times woken from sleep.
+            std::uint64_t   spurious{0};    ///< Wakeups which found no work.
+            std::chrono::nanoseconds busy{0};   ///< Time spent running tasks.
+        };
+
+        std::vector<Thread> threads;        ///< Per thread counters.
+        Thread          total;              ///< The sum over all threads.
+        std::size_t     queued{0};          ///< Tasks in the TaskQueue now.
+        std::size_t     peakQueued{0};      ///< The most there have been.
+        std::size_t     pending{0};         ///< Tasks added but not finished.
+
+        /// How long tasks waited in the TaskQueue, (or a thread's deque),
+        /// before they started.
+        Histogram       queueLatency;
+
+        /// How long tasks took to run.
+        Histogram       runTime;
+    };
+
+    /// How the tasks are distributed among the threads in the pool.
+    enum class Scheduling
+    {
+        Shared,         ///< All threads take tasks from one TaskQueue.
+        WorkStealing    ///< Each thread has its own deque and steals when idle.
+    };
+
+    ThreadPool();
+
+    /// Construct a ThreadPool.
+    /// @param scheduling How tasks are distributed among the threads.
+    /// @param capacity The maximum number of tasks which may be waiting in
+    /// the TaskQueue, or 0 for no limit.  In a work-stealing pool, this
+    /// doesn't limit the tasks added from within the pool's own threads.
+    /// @param order The order in which tasks are taken from the TaskQueue.
+    explicit ThreadPool(Scheduling scheduling,
+                        std::size_t capacity = 0,
+                        Order order = Order::FIFO);
 
-    ThreadPool() = default;
+    /// Drain the pool, (see shutdown()), and wait for the threads to finish.
     ~ThreadPool();
 
     ThreadPool(const ThreadPool &) = delete;
@@ -52,26 +196,120 @@ public:
 
     /// Add a task to the TaskQueue for this pool. Free threads will take
     /// Tasks from the front of the queue and execute them.
+    /// If the TaskQueue is bounded and full, this blocks until there is room,
+    /// (or until the pool is shutdown, in which case the task is dropped).
+    /// @note In a bounded Scheduling::Shared pool, a task which adds more
+    /// tasks should use tryAddTask(), since every thread could otherwise end
+    /// up waiting for room.
     /// @see TaskQueue
     void addTask(Task task);
 
-    /// Add a task with a promise.
+    /// Add a task with a priority.  This is only meaningful if the pool was
+    /// constructed with Order::Priority, in which case the threads take the
+    /// highest priority tasks first.  In a work-stealing pool, prioritized
+    /// tasks always go onto the TaskQueue, never onto a thread's own deque.
+    /// @overload
+    void addTask(Task task, Priority priority);
+
+    /// Add a task which should be run by the given deadline.  The threads
+    /// of a pool constructed with Order::Priority take the tasks with the
+    /// earliest deadlines first.
+    /// @see TaskQueue::deadline()
     /// @overload
-    template <typename Ret>
-    std::promise<Ret> addTask(std::function<Ret ()> work)
+    void addTask(Task task, TaskQueue::Clock::time_point deadline)
     {
+        addTask(std::move(task), TaskQueue::deadline(deadline));
+    }
+
+    /// Add a task to the TaskQueue for this pool, only if there is room.
+    /// @return false if the TaskQueue is full, (or the pool has been
+    /// shutdown), in which case the task is left untouched.
+    bool tryAddTask(Task &&task);
+
+    /// Add a task with a priority, only if there is room.
+    /// @see addTask(Task, Priority)
+    /// @overload
+    bool tryAddTask(Task &&task, Priority priority);
+
+    /// Add a batch of tasks to the pool, taking the mutex only once, (or
+    /// not at all, if called from one of the pool's work-stealing threads),
+    /// and waking only as many waiting threads as there are new tasks.
+    /// If the TaskQueue is bounded, this blocks as addTask() does whenever
+    /// the queue is full.
+    /// @param first,last The range of tasks, (or callables which can be
+    /// converted to tasks), to add.  Each element is moved from.
+    template <typename Iterator>
+    void addTasks(Iterator first, Iterator last)
+    {
+        if (isLocal()) {
+            std::size_t n = 0;
+            for (; first != last; ++first, ++n) {
+                pushLocal(Task(std::move(*first)));
+            }
+            wake(n);
+            return;
+        }
+
+        auto l = lock();
+        std::size_t n = 0;
+        for (; first != last; ++first, ++n) {
+            if (_queue.full()) {
+                wakeLocked(n);
+                n = 0;
+                _full.wait(l, [this]() { return !_queue.full() || _shutdown; });
+            }
+            if (_shutdown) {
+                return;
+            }
+            enqueue(Task(std::move(*first)), 0);
+        }
+        wakeLocked(n);
+    }
+
+    /// Add a batch of tasks to the pool.
+    /// @see addTasks(Iterator, Iterator)
+    /// @overload
+    void addTasks(std::vector<Task> &&tasks)
+    {
+        addTasks(tasks.begin(), tasks.end());
+        tasks.clear();
+    }
+
+    /// Submit a callable to be run by the pool, with the given arguments.
+    /// The callable and the arguments are moved, (or copied), into the
+    /// task; so move-only callables, (and arguments), are fine.
+    /// @return A std::future which will receive the result of the call, or
+    /// the exception it threw.
+    /// @par Example
+    /// @code
+    ///     auto f = pool.submit([](int a, int b) { return a + b; }, 1, 2);
+    ///     assert(f.get() == 3);
+    /// @endcode
+    template <typename F, typename ...Args>
+    auto submit(F &&f, Args&& ...args)
+        -> std::future<std::invoke_result_t<std::decay_t<F>,
+                                            std::decay_t<Args>...> >
+    {
+        using Ret = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
         std::promise<Ret> promise;
-        auto task = [work, &promise] ()
+        auto future = promise.get_future();
+        addTask([promise = std::move(promise),
+                 fn = std::forward<F>(f),
+                 tup = std::tuple<std::decay_t<Args>...>(
+                     std::forward<Args>(args)...)] () mutable
         {
             try {
-                auto r = work();
-                promise.set_value(r);
+                if constexpr (std::is_void_v<Ret>) {
+                    std::apply(std::move(fn), std::move(tup));
+                    promise.set_value();
+                } else {
+                    promise.set_value(std::apply(std::move(fn), std::move(tup)));
+                }
             } catch (...) {
                 promise.set_exception(std::current_exception());
             }
-        };
-        addTask(task);
-        return promise;
+        });
+        return future;
     }
 
     /// Activate the ThreadPool and add active threads to it.
@@ -80,25 +318,139 @@ public:
     /// @param n The number of threads to add to the pool.
     void activate(std::size_t n = 1);
 
-    /// Shutdown the ThreadPool.  All waiting threads will wake up and terminate.
-    /// All running threads will finish their tasks and then terminate.
-    void shutdown();
+    /// Shutdown the ThreadPool.
+    /// With Mode::Immediate, all waiting threads will wake up and terminate,
+    /// and all running threads will finish their tasks and then terminate.
+    /// Tasks which were still waiting to run are removed from the pool and
+    /// returned.  No more tasks will be accepted.
+    ///
+    /// With Mode::Drain, the threads keep running tasks until there are none
+    /// left, and then terminate.  Tasks added by the running tasks are run
+    /// too, but tasks added once every thread has terminated are never run.
+    ///
+    /// In either case, this doesn't wait for the threads.  Call wait() for
+    /// that.
+    /// @return The tasks which will never be run, (always empty for
+    /// Mode::Drain).
+    std::vector<Task> shutdown(Mode mode = Mode::Immediate);
+
+    /// Wait until there are no tasks waiting and none running, (or until the
+    /// pool has been shutdown with Mode::Immediate).  New tasks may still be
+    /// added, after which the pool is no longer idle.
+    void waitIdle();
+
+    /// @return a snapshot of the statistics for the pool.  Each thread keeps
+    /// its own counters, which are only added up here.
+    /// @see Stats
+    Stats stats() const;
 
     /// Wait for all threads to finish
     void wait();
+
+    /// @return the Scheduling used by this pool.
+    Scheduling scheduling() const           { return _scheduling; }
+
+    /// Set the IdlePolicy for the threads in the pool.  This may be changed
+    /// at any time, and takes effect the next time each thread is idle.
+    void idlePolicy(const IdlePolicy &policy);
+
+    /// @return the IdlePolicy for the threads in the pool.
+    IdlePolicy idlePolicy() const;
+
+    /// @return the number of threads which have been added to the pool.
+    std::size_t size() const;
 private:
+    struct Worker;
+    struct Node;
+    struct Counters;
+
     using ThreadPtr = std::unique_ptr<std::thread>;
     using Pool      = std::list<ThreadPtr>;
     using Mutex     = std::mutex;
     using Lock      = std::unique_lock<Mutex>;
     using Cond      = std::condition_variable;
+    using WorkerPtr = std::unique_ptr<Worker>;
+    using Clock     = TaskQueue::Clock;
+    using Workers   = std::vector<Worker*>;
 
     /// This is the function that all threads in the pool will execute.
     /// Each thread will wait for the TaskQueue to be non-empty or the
-    /// ThreadPool to be shutdown.  If shutdown, then the thread will terminate.
+    /// ThreadPool to be shutdown.  If shutdown, (or draining with nothing left
+    /// to do), then the thread will terminate.
     /// If the TaskQueue is non-empty, then the thread will take the next
     /// task from the TaskQueue and execute it.
-    void svc();
+    void svc(Counters &counters);
+
+    /// This is the function that all threads in a work-stealing pool will
+    /// execute.  Each thread runs the tasks from its own deque, and when that
+    /// is empty, steals from the other threads or takes from the TaskQueue.
+    /// If there is no work anywhere, the thread waits for more.
+    /// @param self The Worker for the calling thread.
+    /// @param counters The statistics for the calling thread.
+    void svcStealing(Worker &self, Counters &counters);
+
+    /// Take the next task from the TaskQueue.  The mutex must be held, and
+    /// the TaskQueue must not be empty.
+    /// @param queued Set to the time at which the task was added, (if
+    /// CBI_POOL_STATS is defined).
+    Task take(Clock::time_point &queued);
+
+    /// @return the time at which the task in the node was added, (if
+    /// CBI_POOL_STATS is defined).
+    static Clock::time_point stamp(const Node &node);
+
+    /// Run a task, and record it in the statistics.
+    /// @param queued The time at which the task was added.
+    void run(Task &task, Counters &counters, Clock::time_point queued);
+
+    /// Try to steal a task from one of the other workers.
+    /// @param self The Worker for the calling thread.
+    /// @return the stolen task, or nullptr if there was nothing to steal.
+    Node* steal(Worker &self);
+
+    /// @return true if any worker's deque appears to be non-empty.
+    bool stealable() const;
+
+    /// @return true if the calling thread is one of this pool's
+    /// work-stealing threads.
+    bool isLocal() const;
+
+    /// If the calling thread is one of this pool's workers, push the task
+    /// onto its deque.
+    /// @return false if the calling thread isn't one of this pool's workers.
+    bool addLocal(Task &task);
+
+    /// Push the task onto the calling thread's deque, without waking
+    /// anyone.  The calling thread must be one of this pool's workers.
+    void pushLocal(Task &&task);
+
+    /// Wake up to n waiting threads, taking the mutex if there are any.
+    void wake(std::size_t n);
+
+    /// Wake up to n waiting threads.  The mutex must be held.
+    void wakeLocked(std::size_t n);
+
+    /// Add a task to the TaskQueue, waiting for room if need be.
+    void addShared(Task &&task, Priority priority);
+
+    /// Add a task to the TaskQueue.  The mutex must be held, and the
+    /// TaskQueue must not be full.
+    void enqueue(Task &&task, Priority priority);
+
+    /// Add a task to the TaskQueue and wake a thread to run it.  The mutex
+    /// must be held, and the TaskQueue must not be full.
+    void push(Task &&task, Priority priority);
+
+    /// Called, with the mutex held, after a task has been taken from the
+    /// TaskQueue.
+    void taken();
+
+    /// Called, without the mutex held, after a task has run.
+    void finished();
+
+    /// Wake a waiting thread, if there are any.  This is used after a task
+    /// has been pushed onto a worker's deque without holding the mutex.
+    void wakeOne()                          { wake(1); }
 
     /// Lock the mutex and return a std::unique_lock wrapper.
     Lock lock()                             { return Lock(_mutex); }
@@ -108,7 +460,43 @@ private:
     Pool              _pool;
     mutable Mutex     _mutex;
     Cond              _empty;
-    bool              _shutdown{false};
+    Cond              _full;
+    Cond              _idle;
+    std::atomic<bool> _shutdown{false};
+    std::atomic<bool> _draining{false};
+    Scheduling        _scheduling{Scheduling::Shared};
+
+    /// The number of threads waiting on _empty.  This is only changed with
+    /// the mutex held, but may be read without it.
+    std::atomic<std::size_t>              _sleepers{0};
+
+    /// The number of tasks which have been added but haven't finished
+    /// running.
+    std::atomic<std::size_t>              _pending{0};
+
+    /// The number of tasks in the TaskQueue.  This is only changed with the
+    /// mutex held, but spinning threads read it without the mutex.
+    std::atomic<std::size_t>              _available{0};
+
+    /// The IdlePolicy.
+    std::atomic<std::size_t>              _spins{0};
+    std::atomic<std::size_t>              _yields{0};
+
+    /// The statistics for each thread, and the most tasks there have been
+    /// in the TaskQueue, (only kept if CBI_POOL_STATS is defined).
+    std::list<std::unique_ptr<Counters>>  _counters;
+    std::size_t                           _peakQueued{0};
+
+    /// The workers of a work-stealing pool.  _victims points to the most
+    /// recent snapshot of the workers, so that thieves can find them without
+    /// locking.  Older snapshots are kept alive until the pool is destroyed.
+    std::list<WorkerPtr>                  _workers;
+    std::list<std::unique_ptr<Workers>>   _snapshots;
+    std::atomic<const Workers*>           _victims{nullptr};
+
+    /// The Worker for the calling thread, if it belongs to a work-stealing
+    /// pool.
+    static thread_local Worker           *_local;
 };
 
 ThreadPool&
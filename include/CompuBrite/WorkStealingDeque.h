@@ -0,0 +1,198 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief Interface and implementation for WorkStealingDeque
+*/
+
+#ifndef COMPUBRITE_WORKSTEALINGDEQUE_H_INCLUDED
+#define COMPUBRITE_WORKSTEALINGDEQUE_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace CompuBrite
+{
+
+/**
+ * A lock-free Chase-Lev work-stealing deque.
+ *
+ * A WorkStealingDeque has a single owner thread, which may push() and pop()
+ * items at the bottom, and any number of thief threads, which may steal()
+ * items from the top.  The owner works in LIFO order, (keeping its caches
+ * warm), while thieves take the oldest items.
+ *
+ * The circular buffer grows as needed.  Buffers which have been outgrown
+ * are retained until the deque is destroyed, since a thief may still be
+ * reading from them.
+ *
+ * This follows "Correct and Efficient Work-Stealing for Weak Memory Models",
+ * (Le, Pop, Cohen and Zappa Nardelli, PPoPP 2013).
+ *
+ * @tparam T The item type.  It must be trivially copyable, (typically a
+ * pointer).
+ */
+template <typename T>
+class WorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "WorkStealingDeque items must be trivially copyable");
+public:
+    /// Construct an empty deque.
+    /// @param capacity The initial capacity, which must be a power of two.
+    explicit WorkStealingDeque(std::size_t capacity = 1024) :
+        _array(new Array(capacity))
+    { }
+
+    ~WorkStealingDeque()                   { delete _array.load(); }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /// Push an item onto the bottom of the deque.  Only the owner thread
+    /// may call this.
+    void push(T item)
+    {
+        auto b = _bottom.load(std::memory_order_relaxed);
+        auto t = _top.load(std::memory_order_acquire);
+        auto a = _array.load(std::memory_order_relaxed);
+        if (b - t > static_cast<std::int64_t>(a->capacity()) - 1) {
+            _garbage.emplace_back(a);
+            a = a->grow(t, b);
+            _array.store(a, std::memory_order_release);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /// Pop an item from the bottom of the deque.  Only the owner thread
+    /// may call this.
+    /// @return The most recently pushed item, or nothing if the deque is
+    /// empty.
+    std::optional<T> pop()
+    {
+        auto b = _bottom.load(std::memory_order_relaxed) - 1;
+        auto a = _array.load(std::memory_order_relaxed);
+        _bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = _top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // Empty.
+            _bottom.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        auto item = a->get(b);
+        if (t == b) {
+            // Last item, race against the thieves for it.
+            auto won = _top.compare_exchange_strong(t, t + 1,
+                                                    std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed);
+            _bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won) {
+                return std::nullopt;
+            }
+        }
+        return item;
+    }
+
+    /// Steal an item from the top of the deque.  Any thread may call this.
+    /// @return The oldest item, or nothing if the deque is empty or another
+    /// thread won the race for the item.
+    std::optional<T> steal()
+    {
+        auto t = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = _bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return std::nullopt;
+        }
+        auto a = _array.load(std::memory_order_acquire);
+        auto item = a->get(t);
+        if (!_top.compare_exchange_strong(t, t + 1,
+                                          std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return std::nullopt;
+        }
+        return item;
+    }
+
+    /// @return true if the deque appears to be empty.  This is only a
+    /// snapshot; it may change as soon as it is returned.
+    bool empty() const
+    {
+        auto t = _top.load(std::memory_order_relaxed);
+        auto b = _bottom.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+private:
+    /// A circular buffer of atomic slots.
+    class Array
+    {
+    public:
+        explicit Array(std::size_t capacity) :
+            _mask(capacity - 1),
+            _slots(new std::atomic<T>[capacity])
+        { }
+
+        std::size_t capacity() const          { return _mask + 1; }
+
+        T get(std::int64_t i) const
+        {
+            return _slots[i & _mask].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t i, T item)
+        {
+            _slots[i & _mask].store(item, std::memory_order_relaxed);
+        }
+
+        /// @return a new Array, twice the size, holding the items in
+        /// [top, bottom).
+        Array* grow(std::int64_t top, std::int64_t bottom) const
+        {
+            auto a = new Array(capacity() * 2);
+            for (auto i = top; i < bottom; ++i) {
+                a->put(i, get(i));
+            }
+            return a;
+        }
+
+    private:
+        std::size_t                         _mask;
+        std::unique_ptr<std::atomic<T>[]>   _slots;
+    };
+
+    alignas(64) std::atomic<std::int64_t>   _top{0};
+    alignas(64) std::atomic<std::int64_t>   _bottom{0};
+    std::atomic<Array*>                     _array;
+    std::vector<std::unique_ptr<Array>>     _garbage;
+};
+
+} // namespace CompuBrite
+#endif // COMPUBRITE_WORKSTEALINGDEQUE_H_INCLUDED
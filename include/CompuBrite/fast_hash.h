@@ -0,0 +1,92 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief fast_hash, a 64 bit hash for strings and other byte ranges, with
+ * SIMD implementations chosen at run-time.
+*/
+
+#ifndef COMPUBRITE_FAST_HASH_H_INCLUDED
+#define COMPUBRITE_FAST_HASH_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace CompuBrite {
+
+/// The implementations of fast_hash().  They all give the same hash for the
+/// same bytes, (so a hash may be saved on one machine, and used on another).
+enum class fast_hash_isa
+{
+    scalar,
+    sse2,
+    avx2,
+    neon
+};
+
+/// @return true if the given implementation can run on this machine.
+bool fast_hash_supported(fast_hash_isa isa);
+
+/// @return the implementation that fast_hash() uses, (the best one this
+/// machine supports).
+fast_hash_isa fast_hash_selected();
+
+/// @brief Hash a range of bytes.
+///
+/// Short ranges, (up to 64 bytes), are mixed 16 bytes at a time with 128 bit
+/// multiplies, as wyhash does.  Longer ones are read in 64 byte stripes
+/// into eight 64 bit accumulators, (as XXH3 does), which the SIMD
+/// implementations update several at a time.
+/// @param data,size The bytes to hash.
+/// @param seed Selects a different hash function.
+/// @return The hash, which is the same on every machine.
+std::uint64_t fast_hash(const void *data, std::size_t size, std::uint64_t seed = 0);
+
+/// fast_hash() with the given implementation, (which must be supported), to
+/// check that they agree.
+std::uint64_t fast_hash(fast_hash_isa isa, const void *data, std::size_t size,
+                        std::uint64_t seed = 0);
+
+/// @return the fast_hash() of a string.
+inline std::uint64_t fast_hash(std::string_view str, std::uint64_t seed = 0)
+{
+    return fast_hash(str.data(), str.size(), seed);
+}
+
+/// A hasher for strings using fast_hash(), (for use with unordered
+/// containers).  It is transparent, so it hashes a std::string, a
+/// std::string_view and a const char * alike.
+struct fast_hasher
+{
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view str) const
+    {
+        return static_cast<std::size_t>(fast_hash(str));
+    }
+};
+
+} // namespace CompuBrite
+
+#endif // COMPUBRITE_FAST_HASH_H_INCLUDED
@@ -0,0 +1,722 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief flat_map, an open addressed hash map, (a Swiss table), which keeps
+ * its values in a single array.
+*/
+
+#ifndef COMPUBRITE_FLAT_MAP_H_INCLUDED
+#define COMPUBRITE_FLAT_MAP_H_INCLUDED
+
+#include <CompuBrite/fast_hash.h>
+#include <CompuBrite/hash_util.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace CompuBrite
+{
+
+namespace detail
+{
+
+/// The control byte of a slot which has never been used.  A full slot's
+/// control byte holds seven bits of its hash, (so its top bit is clear).
+constexpr std::uint8_t FlatEmpty = 0x80;
+
+/// The control byte of a slot whose value has been erased.
+constexpr std::uint8_t FlatDeleted = 0xFE;
+
+/// @return the bits of a hash kept in the control byte.
+inline std::uint8_t flat_tag(std::size_t hash)      { return static_cast<std::uint8_t>(hash & 0x7F); }
+
+/// @return the bits of a hash which choose the first group to probe.
+inline std::size_t flat_start(std::size_t hash)     { return hash >> 7; }
+
+/// A set of slots in a group, (held as one bit, or one byte, per slot), for
+/// a range-for over their positions, lowest first.
+template <typename Mask, int Shift>
+class FlatBits
+{
+public:
+    explicit FlatBits(Mask mask) : _mask(mask) { }
+
+    explicit operator bool() const            { return _mask != 0; }
+
+    std::size_t operator*() const
+    {
+#if defined(__GNUC__)
+        return static_cast<std::size_t>(__builtin_ctzll(_mask)) >> Shift;
+#else
+        std::size_t n = 0;
+        for (auto m = _mask; !(m & 1); m >>= 1) {
+            ++n;
+        }
+        return n >> Shift;
+#endif
+    }
+
+    FlatBits& operator++()
+    {
+        _mask &= _mask - 1;
+        return *this;
+    }
+
+    bool operator!=(const FlatBits &other) const { return _mask != other._mask; }
+
+    FlatBits begin() const                    { return *this; }
+    FlatBits end() const                      { return FlatBits(0); }
+
+private:
+    Mask _mask;
+};
+
+/// Eight control bytes in a 64 bit word, (byte i in bits 8i to 8i + 7),
+/// matched all at once with integer arithmetic.  Being a single word, it
+/// may also be kept in a std::atomic.
+class FlatWord
+{
+public:
+    static constexpr std::size_t Width = 8;
+    using Bits = FlatBits<std::uint64_t, 3>;
+
+    /// A word of empty control bytes.
+    static constexpr std::uint64_t Empty = 0x8080808080808080ull;
+
+    explicit FlatWord(std::uint64_t ctrl) : _ctrl(ctrl) { }
+
+    /// @return the group of control bytes at p.
+    static FlatWord at(const std::uint8_t *p)
+    {
+        std::uint64_t ctrl;
+        std::memcpy(&ctrl, p, sizeof(ctrl));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        ctrl = __builtin_bswap64(ctrl);
+#endif
+        return FlatWord(ctrl);
+    }
+
+    /// @return the slots with the given tag.  This may include a full slot
+    /// just after one which matches, (the caller compares the keys anyway),
+    /// but never an empty or deleted one.
+    Bits match(std::uint8_t tag) const
+    {
+        auto x = _ctrl ^ (Lsbs * tag);
+        return Bits((x - Lsbs) & ~x & Msbs);
+    }
+
+    /// @return the empty slots.
+    Bits match_empty() const                  { return Bits(_ctrl & ~(_ctrl << 6) & Msbs); }
+
+    /// @return the empty and deleted slots.
+    Bits match_free() const                   { return Bits(_ctrl & Msbs); }
+
+    /// @return this group with slot i's control byte set.
+    FlatWord with(std::size_t i, std::uint8_t ctrl) const
+    {
+        auto shift = 8 * i;
+        return FlatWord((_ctrl & ~(std::uint64_t{0xFF} << shift)) |
+                        (std::uint64_t{ctrl} << shift));
+    }
+
+    std::uint64_t word() const                { return _ctrl; }
+
+private:
+    static constexpr std::uint64_t Lsbs = 0x0101010101010101ull;
+    static constexpr std::uint64_t Msbs = 0x8080808080808080ull;
+
+    std::uint64_t _ctrl;
+};
+
+#ifdef __SSE2__
+/// Sixteen control bytes, matched with SSE2 compares.
+class FlatGroup16
+{
+public:
+    static constexpr std::size_t Width = 16;
+    using Bits = FlatBits<std::uint32_t, 0>;
+
+    static FlatGroup16 at(const std::uint8_t *p)
+    {
+        return FlatGroup16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+
+    Bits match(std::uint8_t tag) const        { return equal(tag); }
+    Bits match_empty() const                  { return equal(FlatEmpty); }
+    Bits match_free() const                   { return Bits(_mm_movemask_epi8(_ctrl)); }
+
+private:
+    explicit FlatGroup16(__m128i ctrl) : _ctrl(ctrl) { }
+
+    Bits equal(std::uint8_t ctrl) const
+    {
+        auto v = _mm_set1_epi8(static_cast<char>(ctrl));
+        return Bits(static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _ctrl))));
+    }
+
+    __m128i _ctrl;
+};
+
+using FlatGroup = FlatGroup16;
+#else
+using FlatGroup = FlatWord;
+#endif
+
+template <typename Key>
+constexpr bool flat_is_string = std::is_same_v<Key, std::string> ||
+                                std::is_same_v<Key, std::string_view>;
+
+/// The default hash for a flat_map: fast_hash() for strings, else std::hash.
+template <typename Key>
+using flat_default_hash = std::conditional_t<flat_is_string<Key>, fast_hasher, std::hash<Key>>;
+
+/// The default equality for a flat_map, (transparent for strings).
+template <typename Key>
+using flat_default_equal = std::conditional_t<flat_is_string<Key>, std::equal_to<>,
+                                              std::equal_to<Key>>;
+
+template <typename T, typename = void>
+struct flat_is_transparent : std::false_type { };
+
+template <typename T>
+struct flat_is_transparent<T, std::void_t<typename T::is_transparent>> : std::true_type { };
+
+/// The type of key a lookup takes: any K if the hash and equality are both
+/// transparent, else Key.  (This is a member alias template, rather than
+/// std::conditional, so that K may still be deduced.)
+template <bool Transparent>
+struct FlatKeyArg
+{
+    template <typename K, typename Key>
+    using type = K;
+};
+
+template <>
+struct FlatKeyArg<false>
+{
+    template <typename K, typename Key>
+    using type = Key;
+};
+
+} // namespace detail
+
+/// A flat_map is an unordered map which keeps its values in one array, with
+/// no allocation for each value, (a Swiss table).  Each slot has a control
+/// byte holding seven bits of its key's hash, and the slots are probed a
+/// group at a time, (16 with SSE2, else 8 with integer arithmetic), so a
+/// lookup touches one or two cache lines, and compares only the keys whose
+/// control bytes match.  The map grows when it is 7/8 full.
+///
+/// If the hash and equality are both transparent, (as they are by default
+/// for std::string keys), the lookups take anything they accept, such as a
+/// std::string_view or a const char *, without making a Key.
+///
+/// Unlike std::unordered_map, growing a flat_map moves its values, which
+/// invalidates iterators, pointers and references to them.  The value_type
+/// is a std::pair<Key, T>, (so that values can be moved), but the key must
+/// not be changed through an iterator.
+/// @tparam Key The key type.
+/// @tparam T The mapped type.
+/// @tparam Hash The hash.  Its result is mixed further, (except for
+/// fast_hasher), so std::hash of an integer will do.
+/// @tparam KeyEqual The key equality.
+template <typename Key, typename T,
+          typename Hash = detail::flat_default_hash<Key>,
+          typename KeyEqual = detail::flat_default_equal<Key> >
+class flat_map
+{
+    using Group = detail::FlatGroup;
+
+    static constexpr bool Transparent = detail::flat_is_transparent<Hash>::value &&
+                                        detail::flat_is_transparent<KeyEqual>::value;
+
+    template <typename K>
+    using key_arg = typename detail::FlatKeyArg<Transparent>::template type<K, Key>;
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key, T>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+
+    /// A forward iterator over the values in a flat_map.
+    template <bool Const>
+    class basic_iterator
+    {
+        using Map = std::conditional_t<Const, const flat_map, flat_map>;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = flat_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+
+        basic_iterator() = default;
+
+        /// An iterator converts to a const_iterator.
+        template <bool C = Const, typename = std::enable_if_t<C> >
+        basic_iterator(const basic_iterator<false> &other) :
+            _map(other._map),
+            _index(other._index)
+        { }
+
+        reference operator*() const       { return _map->_slots[_index].value; }
+        pointer operator->() const        { return &**this; }
+
+        basic_iterator& operator++()
+        {
+            ++_index;
+            skip();
+            return *this;
+        }
+
+        basic_iterator operator++(int)
+        {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const basic_iterator &other) const { return _index == other._index; }
+        bool operator!=(const basic_iterator &other) const { return _index != other._index; }
+
+    private:
+        friend class flat_map;
+        friend class basic_iterator<!Const>;
+
+        basic_iterator(Map *map, size_type index) :
+            _map(map),
+            _index(index)
+        { }
+
+        /// Move on to the next full slot, (or the end).
+        void skip()
+        {
+            while (_index < _map->_capacity && (_map->_ctrl[_index] & detail::FlatEmpty)) {
+                ++_index;
+            }
+        }
+
+        Map        *_map{nullptr};
+        size_type   _index{0};
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    /// Construct an empty flat_map, which allocates nothing until the first
+    /// value is added.
+    flat_map() = default;
+
+    /// Construct an empty flat_map with room for n values.
+    explicit flat_map(size_type n, const Hash &hash = Hash(),
+                      const KeyEqual &equal = KeyEqual()) :
+        _hash(hash),
+        _equal(equal)
+    {
+        reserve(n);
+    }
+
+    flat_map(std::initializer_list<value_type> init)
+    {
+        reserve(init.size());
+        for (auto &v : init) {
+            insert(v);
+        }
+    }
+
+    flat_map(const flat_map &other) :
+        _hash(other._hash),
+        _equal(other._equal)
+    {
+        reserve(other.size());
+        for (auto &v : other) {
+            add(hash_of(v.first), v);
+        }
+    }
+
+    flat_map(flat_map &&other) noexcept                 { swap(other); }
+
+    flat_map& operator=(flat_map other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~flat_map()                                         { destroy(); }
+
+    iterator begin()
+    {
+        iterator it(this, 0);
+        it.skip();
+        return it;
+    }
+
+    const_iterator begin() const
+    {
+        const_iterator it(this, 0);
+        it.skip();
+        return it;
+    }
+
+    iterator end()                                      { return iterator(this, _capacity); }
+    const_iterator end() const                          { return const_iterator(this, _capacity); }
+
+    bool empty() const                                  { return _size == 0; }
+    size_type size() const                              { return _size; }
+
+    /// @return the number of slots, (which is more than the number of
+    /// values which fit before the map grows).
+    size_type capacity() const                          { return _capacity; }
+
+    /// Remove every value, keeping the slots.
+    void clear()
+    {
+        for (size_type i = 0; i < _capacity; ++i) {
+            if (!(_ctrl[i] & detail::FlatEmpty)) {
+                _slots[i].value.~value_type();
+            }
+            _ctrl[i] = detail::FlatEmpty;
+        }
+        _size = 0;
+        _growth = growth(_capacity);
+    }
+
+    /// Make room for n values, so that adding them doesn't grow the map.
+    void reserve(size_type n)
+    {
+        if (n > _size + _growth) {
+            resize(capacity_for(n));
+        }
+    }
+
+    /// @return an iterator to the value with the given key, or end().
+    template <typename K = Key>
+    iterator find(const key_arg<K> &key)
+    {
+        return iterator(this, find_index(key, hash_of(key)));
+    }
+
+    template <typename K = Key>
+    const_iterator find(const key_arg<K> &key) const
+    {
+        return const_iterator(this, find_index(key, hash_of(key)));
+    }
+
+    /// @return true if there is a value with the given key.
+    template <typename K = Key>
+    bool contains(const key_arg<K> &key) const
+    {
+        return find_index(key, hash_of(key)) != _capacity;
+    }
+
+    template <typename K = Key>
+    size_type count(const key_arg<K> &key) const        { return contains<K>(key) ? 1 : 0; }
+
+    /// @return the mapped value with the given key.
+    /// @throw std::out_of_range if there is none.
+    template <typename K = Key>
+    T& at(const key_arg<K> &key)
+    {
+        auto index = find_index(key, hash_of(key));
+        if (index == _capacity) {
+            throw std::out_of_range("flat_map: no such key");
+        }
+        return _slots[index].value.second;
+    }
+
+    template <typename K = Key>
+    const T& at(const key_arg<K> &key) const
+    {
+        return const_cast<flat_map*>(this)->template at<K>(key);
+    }
+
+    /// @return the mapped value with the given key, adding a value
+    /// initialized one if there is none.
+    template <typename K = Key>
+    T& operator[](const key_arg<K> &key)                { return try_emplace<K>(key).first->second; }
+
+    T& operator[](Key &&key)                            { return try_emplace(std::move(key)).first->second; }
+
+    /// Add a value with the given key, (made from args), unless there is one
+    /// already, in which case args are left alone.
+    /// @return an iterator to the value with the key, and true if it was
+    /// added.
+    template <typename K = Key, typename... Args>
+    std::pair<iterator, bool> try_emplace(const key_arg<K> &key, Args &&...args)
+    {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key &&key, Args &&...args)
+    {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value)
+    {
+        return emplace_key(value.first, value.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&value)
+    {
+        return emplace_key(std::move(value.first), std::move(value.second));
+    }
+
+    /// Add a value made from args, unless there is one with its key already.
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args &&...args)
+    {
+        return insert(value_type(std::forward<Args>(args)...));
+    }
+
+    /// Remove the value with the given key, if there is one.
+    /// @return the number of values removed.
+    template <typename K = Key>
+    size_type erase(const key_arg<K> &key)
+    {
+        auto index = find_index(key, hash_of(key));
+        if (index == _capacity) {
+            return 0;
+        }
+        remove(index);
+        return 1;
+    }
+
+    /// Remove the value at pos.
+    /// @return an iterator to the next value.
+    iterator erase(const_iterator pos)
+    {
+        remove(pos._index);
+        iterator it(this, pos._index);
+        it.skip();
+        return it;
+    }
+
+    void swap(flat_map &other) noexcept
+    {
+        using std::swap;
+        swap(_ctrl, other._ctrl);
+        swap(_slots, other._slots);
+        swap(_capacity, other._capacity);
+        swap(_size, other._size);
+        swap(_growth, other._growth);
+        swap(_hash, other._hash);
+        swap(_equal, other._equal);
+    }
+
+    hasher hash_function() const                        { return _hash; }
+    key_equal key_eq() const                            { return _equal; }
+
+private:
+    /// The storage for a value, which is only constructed while the slot is
+    /// full.
+    union Slot
+    {
+        Slot()  { }
+        ~Slot() { }
+
+        value_type value;
+    };
+
+    /// @return the number of values which fit in the given number of slots.
+    static size_type growth(size_type capacity)         { return capacity - capacity / 8; }
+
+    /// @return the number of slots for n values.
+    static size_type capacity_for(size_type n)
+    {
+        size_type capacity = Group::Width;
+        while (growth(capacity) < n) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    template <typename K>
+    std::size_t hash_of(const K &key) const
+    {
+        if constexpr (std::is_same_v<Hash, fast_hasher>) {
+            return _hash(key);
+        } else {
+            return static_cast<std::size_t>(hash_mix(_hash(key), hash_seed));
+        }
+    }
+
+    /// @return the slot holding the given key, or _capacity if there is
+    /// none.
+    template <typename K>
+    size_type find_index(const K &key, std::size_t hash) const
+    {
+        if (!_capacity) {
+            return _capacity;
+        }
+        auto mask = _capacity / Group::Width - 1;
+        auto g = detail::flat_start(hash) & mask;
+        auto tag = detail::flat_tag(hash);
+        for (size_type step = 1; ; ++step) {
+            auto group = Group::at(&_ctrl[g * Group::Width]);
+            for (auto i : group.match(tag)) {
+                auto index = g * Group::Width + i;
+                if (_equal(_slots[index].value.first, key)) {
+                    return index;
+                }
+            }
+            if (group.match_empty()) {
+                return _capacity;
+            }
+            g = (g + step) & mask;
+        }
+    }
+
+    /// @return the first free slot for a value with the given hash.
+    size_type free_index(std::size_t hash) const
+    {
+        auto mask = _capacity / Group::Width - 1;
+        auto g = detail::flat_start(hash) & mask;
+        for (size_type step = 1; ; ++step) {
+            if (auto free = Group::at(&_ctrl[g * Group::Width]).match_free()) {
+                return g * Group::Width + *free;
+            }
+            g = (g + step) & mask;
+        }
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> emplace_key(K &&key, Args &&...args)
+    {
+        auto hash = hash_of(key);
+        auto index = find_index(key, hash);
+        if (index != _capacity) {
+            return {iterator(this, index), false};
+        }
+        index = add(hash, std::piecewise_construct,
+                    std::forward_as_tuple(std::forward<K>(key)),
+                    std::forward_as_tuple(std::forward<Args>(args)...));
+        return {iterator(this, index), true};
+    }
+
+    /// Add a value, (made from args), whose key isn't in the map.
+    /// @return its slot.
+    template <typename... Args>
+    size_type add(std::size_t hash, Args &&...args)
+    {
+        if (!_growth) {
+            // Erased slots are only reused by chance, so if many of them
+            // have used up the room, clear them out rather than growing.
+            resize(_size + 1 <= growth(_capacity) / 2 ? _capacity
+                                                      : capacity_for(_size + 1));
+        }
+        auto index = free_index(hash);
+        ::new (static_cast<void*>(&_slots[index].value)) value_type(std::forward<Args>(args)...);
+        if (_ctrl[index] == detail::FlatEmpty) {
+            --_growth;
+        }
+        _ctrl[index] = detail::flat_tag(hash);
+        ++_size;
+        return index;
+    }
+
+    /// Destroy the value in a slot.
+    void remove(size_type index)
+    {
+        _slots[index].value.~value_type();
+        --_size;
+
+        // A probe only passes a group which has no empty slots, so if this
+        // group has one, no probe can have passed this slot, and it can
+        // be emptied, rather than marked deleted.
+        auto start = index - index % Group::Width;
+        if (Group::at(&_ctrl[start]).match_empty()) {
+            _ctrl[index] = detail::FlatEmpty;
+            ++_growth;
+        } else {
+            _ctrl[index] = detail::FlatDeleted;
+        }
+    }
+
+    /// Move the values into the given number of slots.
+    void resize(size_type capacity)
+    {
+        std::unique_ptr<std::uint8_t[]> ctrl(new std::uint8_t[capacity]);
+        std::unique_ptr<Slot[]> slots(new Slot[capacity]);
+        std::memset(ctrl.get(), detail::FlatEmpty, capacity);
+
+        std::swap(_ctrl, ctrl);
+        std::swap(_slots, slots);
+        auto old = _capacity;
+        _capacity = capacity;
+        _growth = growth(capacity) - _size;
+        for (size_type i = 0; i < old; ++i) {
+            if (!(ctrl[i] & detail::FlatEmpty)) {
+                auto &v = slots[i].value;
+                auto hash = hash_of(v.first);
+                auto index = free_index(hash);
+                ::new (static_cast<void*>(&_slots[index].value)) value_type(std::move(v));
+                _ctrl[index] = detail::flat_tag(hash);
+                v.~value_type();
+            }
+        }
+    }
+
+    void destroy()
+    {
+        for (size_type i = 0; i < _capacity; ++i) {
+            if (!(_ctrl[i] & detail::FlatEmpty)) {
+                _slots[i].value.~value_type();
+            }
+        }
+    }
+
+    std::unique_ptr<std::uint8_t[]> _ctrl;
+    std::unique_ptr<Slot[]>         _slots;
+    size_type                       _capacity{0};
+    size_type                       _size{0};
+    size_type                       _growth{0};
+    Hash                            _hash;
+    KeyEqual                        _equal;
+};
+
+} // namespace CompuBrite
+#endif // COMPUBRITE_FLAT_MAP_H_INCLUDED
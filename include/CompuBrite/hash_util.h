@@ -21,16 +21,68 @@
  * SOFTWARE.
  *
  * @file
- * @brief Specialization of std::hash over std::pair, and hash related
- * utility functions.
+ * @brief Specialization of std::hash over std::pair and std::tuple, and hash
+ * related utility functions.
 */
 
 #ifndef COMPUBRITE_HASH_UTIL_H_INCLUDED
 #define COMPUBRITE_HASH_UTIL_H_INCLUDED
 
+#include <CompuBrite/fast_hash.h>
+
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 
+namespace CompuBrite {
+
+    /// The starting value for hash_combine(), (any constant will do, but
+    /// not zero).
+    constexpr std::size_t hash_seed = 0x9e3779b97f4a7c15ull;
+
+    /// Mix two 64 bit values into one, (as wyhash does: multiply them to
+    /// 128 bits, and fold the halves together).  Every bit of the result
+    /// depends on every bit of both values, so integers, (which std::hash
+    /// leaves as they are), are spread across the whole range.
+    /// @return The mixed value.
+    inline std::uint64_t hash_mix(std::uint64_t a, std::uint64_t b)
+    {
+#ifdef __SIZEOF_INT128__
+        auto r = static_cast<unsigned __int128>(a ^ 0xa0761d6478bd642full) *
+                 (b ^ 0xe7037ed1a0b428dbull);
+        return static_cast<std::uint64_t>(r >> 64) ^ static_cast<std::uint64_t>(r);
+#else
+        // The same idea, for compilers without 128 bit integers.
+        auto x = (a ^ 0xa0761d6478bd642full) * 0xbf58476d1ce4e5b9ull + b;
+        x = (x ^ (x >> 31)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 29);
+#endif
+    }
+
+    /// Combine the hash of a value into a seed.  The result depends on the
+    /// order in which values are combined, so (a, b) and (b, a) differ, as
+    /// do (a, a) and (b, b).
+    /// Strings are hashed with fast_hash(), rather than std::hash.
+    /// @param seed The hash so far, (start with hash_seed).
+    /// @param value The value to hash into it.
+    template <typename T>
+    void hash_combine(std::size_t &seed, const T &value)
+    {
+        if constexpr (std::is_same_v<T, std::string> ||
+                      std::is_same_v<T, std::string_view>) {
+            seed = static_cast<std::size_t>(hash_mix(seed, fast_hash(value)));
+        } else {
+            seed = static_cast<std::size_t>(hash_mix(seed, std::hash<T>()(value)));
+        }
+    }
+
+} // namespace CompuBrite
+
 namespace std {
 
     /// Create a hash for a given type.
@@ -43,6 +95,19 @@ namespace std {
         return hash<T>()(t);
     }
 
+    /// Create a hash over several values, (with CompuBrite::hash_combine()).
+    /// @param t,u,args The values to hash, in order.
+    /// @return The hash value.
+    template <typename T, typename U, typename ...Args>
+    size_t make_hash(const T &t, const U &u, const Args& ...args)
+    {
+        auto seed = CompuBrite::hash_seed;
+        CompuBrite::hash_combine(seed, t);
+        CompuBrite::hash_combine(seed, u);
+        (CompuBrite::hash_combine(seed, args), ...);
+        return seed;
+    }
+
     /// Compute a hash value for the a std::pair of a given type.
     /// @tparam T The type for the first member of the pair.
     /// @tparam U the type for the second member of the pair.
@@ -52,7 +117,22 @@ namespace std {
     struct hash< pair<T, U> > {
         size_t operator()(const pair<T, U> &p) const
         {
-            return make_hash(p.first) ^ (make_hash(p.second) << 1);
+            return make_hash(p.first, p.second);
+        }
+    };
+
+    /// Compute a hash value for a std::tuple, (combining its members in
+    /// order).
+    /// @tparam Ts The types of the members.
+    template <typename ...Ts>
+    struct hash< tuple<Ts...> > {
+        size_t operator()(const tuple<Ts...> &t) const
+        {
+            auto seed = CompuBrite::hash_seed;
+            apply([&seed](const auto& ...members) {
+                (CompuBrite::hash_combine(seed, members), ...);
+            }, t);
+            return seed;
         }
     };
 }
@@ -0,0 +1,47 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief The CBI_HEADER_ONLY option, and the CBI_INLINE macro used to
+ * implement it.
+*/
+
+#ifndef COMPUBRITE_HEADER_ONLY_H_INCLUDED
+#define COMPUBRITE_HEADER_ONLY_H_INCLUDED
+
+/// If CBI_HEADER_ONLY is defined, the implementations of TaskQueue and
+/// string_pool, (normally compiled into the library), are included by their
+/// headers, so that hot calls such as TaskQueue::take() and
+/// string_record::from_string() may be inlined into their callers.  Their
+/// .cpp files then compile to nothing.  Like CBI_TASK_SIZE, it must be the
+/// same for the library and all of its clients.
+///
+/// CBI_INLINE marks the functions and variables of those implementations,
+/// which are inline in a header-only build, and ordinary definitions
+/// otherwise.
+#ifdef CBI_HEADER_ONLY
+#define CBI_INLINE inline
+#else
+#define CBI_INLINE
+#endif
+
+#endif // COMPUBRITE_HEADER_ONLY_H_INCLUDED
@@ -0,0 +1,181 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief A move-only, type-erased task with inline storage.
+*/
+
+#ifndef COMPUBRITE_INPLACE_TASK_H_INCLUDED
+#define COMPUBRITE_INPLACE_TASK_H_INCLUDED
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace CompuBrite
+{
+
+/// An inplace_task holds any callable object which can be called with no
+/// arguments, (its result, if any, is discarded).  Unlike std::function,
+/// an inplace_task is move-only, so it can hold move-only callables such as
+/// lambdas which capture a std::promise or a std::unique_ptr.
+///
+/// Callables of up to Size bytes, (and whose move constructor doesn't throw),
+/// are stored inline and never touch the heap.  Larger callables are stored
+/// on the heap.
+/// @tparam Size The inline capacity in bytes.
+template <std::size_t Size = 64>
+class inplace_task
+{
+    static_assert(Size >= sizeof(void*),
+                  "inplace_task must be able to hold at least a pointer");
+public:
+    /// @return true if a callable of type F will be stored inline.
+    template <typename F>
+    static constexpr bool fits_inline =
+        sizeof(F) <= Size &&
+        alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible_v<F>;
+
+    /// Construct an empty inplace_task.
+    inplace_task() noexcept = default;
+    inplace_task(std::nullptr_t) noexcept { }
+
+    /// Construct an inplace_task holding the given callable.
+    template <typename F,
+              typename Fn = std::decay_t<F>,
+              typename = std::enable_if_t<
+                  !std::is_same_v<Fn, inplace_task> &&
+                  std::is_invocable_v<Fn&> > >
+    inplace_task(F &&f)
+    {
+        if constexpr (fits_inline<Fn>) {
+            ::new (static_cast<void*>(_storage)) Fn(std::forward<F>(f));
+            _ops = &Inline<Fn>::ops;
+        } else {
+            ::new (static_cast<void*>(_storage)) Fn*(new Fn(std::forward<F>(f)));
+            _ops = &Heap<Fn>::ops;
+        }
+    }
+
+    inplace_task(inplace_task &&other) noexcept { steal(other); }
+
+    inplace_task& operator=(inplace_task &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            steal(other);
+        }
+        return *this;
+    }
+
+    inplace_task& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    inplace_task(const inplace_task &) = delete;
+    inplace_task& operator=(const inplace_task &) = delete;
+
+    ~inplace_task()                                  { reset(); }
+
+    /// Call the held callable.  The inplace_task must not be empty.
+    void operator()()                                { _ops->invoke(_storage); }
+
+    /// @return true if this inplace_task holds a callable.
+    explicit operator bool() const noexcept          { return _ops != nullptr; }
+
+    /// Destroy the held callable, if any, leaving this inplace_task empty.
+    void reset() noexcept
+    {
+        if (_ops) {
+            _ops->destroy(_storage);
+            _ops = nullptr;
+        }
+    }
+
+private:
+    /// The type-specific operations on the storage.
+    struct Ops
+    {
+        void (*invoke)(void *);
+        void (*move)(void *dst, void *src) noexcept;
+        void (*destroy)(void *) noexcept;
+    };
+
+    /// Operations for a callable stored in _storage.
+    template <typename Fn>
+    struct Inline
+    {
+        static Fn& get(void *p)        { return *std::launder(static_cast<Fn*>(p)); }
+
+        static void invoke(void *p)    { get(p)(); }
+
+        static void move(void *dst, void *src) noexcept
+        {
+            ::new (dst) Fn(std::move(get(src)));
+            get(src).~Fn();
+        }
+
+        static void destroy(void *p) noexcept   { get(p).~Fn(); }
+
+        static constexpr Ops ops{&invoke, &move, &destroy};
+    };
+
+    /// Operations for a callable stored on the heap, with a pointer to it
+    /// in _storage.
+    template <typename Fn>
+    struct Heap
+    {
+        static Fn*& get(void *p)       { return *std::launder(static_cast<Fn**>(p)); }
+
+        static void invoke(void *p)    { (*get(p))(); }
+
+        static void move(void *dst, void *src) noexcept
+        {
+            ::new (dst) Fn*(get(src));
+        }
+
+        static void destroy(void *p) noexcept   { delete get(p); }
+
+        static constexpr Ops ops{&invoke, &move, &destroy};
+    };
+
+    /// Take the callable from other, leaving other empty.
+    void steal(inplace_task &other) noexcept
+    {
+        if (other._ops) {
+            other._ops->move(_storage, other._storage);
+            _ops = other._ops;
+            other._ops = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char _storage[Size];
+    const Ops *_ops{nullptr};
+};
+
+} // namespace CompuBrite
+#endif // COMPUBRITE_INPLACE_TASK_H_INCLUDED
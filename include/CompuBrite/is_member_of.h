@@ -1,6 +1,7 @@
 #ifndef IS_MEMBER_OF_H_INCLUDED
 #define IS_MEMBER_OF_H_INCLUDED
 
+#include <cstddef>
 #include <variant>
 #include <type_traits>
 
@@ -15,6 +16,37 @@ std::bool_constant< (std::is_same_v< T, Ts > || ...) >
 template< typename T, typename U>
 inline constexpr bool is_member_of_v = is_member_of<T, U>::value;
 
+template< typename T, typename U> struct index_in;
+
+/// The position of T among the alternatives of a std::variant, (as
+/// std::variant::index() would give), or std::variant_npos if T isn't one of
+/// them, or is more than one.
+template< typename T, typename... Ts>
+struct index_in<T, std::variant< Ts... > >
+{
+private:
+    static constexpr std::size_t find()
+    {
+        constexpr bool same[] = {std::is_same_v< T, Ts >..., false};
+        std::size_t found = std::variant_npos;
+        for (std::size_t i = 0; i < sizeof...(Ts); ++i) {
+            if (same[i]) {
+                if (found != std::variant_npos) {
+                    return std::variant_npos;
+                }
+                found = i;
+            }
+        }
+        return found;
+    }
+
+public:
+    static constexpr std::size_t value = find();
+};
+
+template< typename T, typename U>
+inline constexpr std::size_t index_in_v = index_in<T, U>::value;
+
 } // namespace CompuBrite
 
 #endif // IS_MEMBER_OF_H_INCLUDED
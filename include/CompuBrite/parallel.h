@@ -0,0 +1,279 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief Data-parallel algorithms, (parallel_for and parallel_reduce), which
+ * run on a ThreadPool.
+*/
+
+#ifndef COMPUBRITE_PARALLEL_H_INCLUDED
+#define COMPUBRITE_PARALLEL_H_INCLUDED
+
+#include <CompuBrite/ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace CompuBrite
+{
+
+namespace detail
+{
+
+/// @return the value at the given offset from first.  For an integer,
+/// this is the integer itself, for an iterator it is the element.
+template <typename Index>
+decltype(auto) parallel_at(const Index &first, std::size_t offset)
+{
+    if constexpr (std::is_integral_v<Index>) {
+        return static_cast<Index>(first + static_cast<Index>(offset));
+    } else {
+        return *std::next(first, offset);
+    }
+}
+
+/// @return the number of values in [first, last).
+template <typename Index>
+std::size_t parallel_distance(const Index &first, const Index &last)
+{
+    if constexpr (std::is_integral_v<Index>) {
+        return first < last ? static_cast<std::size_t>(last - first) : 0;
+    } else {
+        return static_cast<std::size_t>(std::distance(first, last));
+    }
+}
+
+/// The state shared by every thread taking part in a parallel algorithm.
+/// The range is handed out in chunks from an atomic cursor.  Each chunk is
+/// a share of what remains, (but never less than the grain), so the chunks
+/// are large at first, and shrink towards the end to balance the load.
+class ParallelJob
+{
+public:
+    ParallelJob(std::size_t total, std::size_t grain, std::size_t parties) :
+        _total(total),
+        _grain(std::max<std::size_t>(grain, 1)),
+        _parties(std::max<std::size_t>(parties, 1))
+    { }
+
+    /// Claim the next chunk of the range.
+    /// @return false if there is nothing left to claim.
+    bool claim(std::size_t &begin, std::size_t &end)
+    {
+        auto cur = _cursor.load(std::memory_order_relaxed);
+        while (cur < _total) {
+            auto remaining = _total - cur;
+            auto size = std::min(remaining,
+                                 std::max(_grain, remaining / (2 * _parties)));
+            if (_cursor.compare_exchange_weak(cur, cur + size,
+                                              std::memory_order_relaxed)) {
+                begin = cur;
+                end = cur + size;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Run every chunk which can still be claimed.
+    /// @param fn Called as fn(begin, end) for each claimed chunk.
+    template <typename Fn>
+    void run(Fn &fn)
+    {
+        std::size_t begin, end;
+        while (claim(begin, end)) {
+            try {
+                fn(begin, end);
+            } catch (...) {
+                fail(std::current_exception());
+            }
+            finished(end - begin);
+        }
+    }
+
+    /// Wait until every chunk has finished, then rethrow the first
+    /// exception thrown by any of them.
+    void wait()
+    {
+        {
+            std::unique_lock<std::mutex> l(_mutex);
+            _cond.wait(l, [this]() { return _done == _total; });
+        }
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+    std::size_t total() const                { return _total; }
+
+private:
+    /// Record the exception, and abandon the unclaimed part of the range.
+    void fail(std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> l(_mutex);
+            if (!_error) {
+                _error = error;
+            }
+        }
+        auto cur = _cursor.exchange(_total, std::memory_order_relaxed);
+        if (cur < _total) {
+            finished(_total - cur);
+        }
+    }
+
+    void finished(std::size_t n)
+    {
+        if (_done.fetch_add(n, std::memory_order_acq_rel) + n == _total) {
+            std::lock_guard<std::mutex> l(_mutex);
+            _cond.notify_all();
+        }
+    }
+
+private:
+    const std::size_t           _total;
+    const std::size_t           _grain;
+    const std::size_t           _parties;
+    std::atomic<std::size_t>    _cursor{0};
+    std::atomic<std::size_t>    _done{0};
+    std::mutex                  _mutex;
+    std::condition_variable     _cond;
+    std::exception_ptr          _error;
+};
+
+/// Run fn(begin, end) over chunks of [0, total) on the pool's threads and on
+/// the calling thread, returning once every chunk has finished.  The
+/// calling thread works through the chunks too, so this finishes even if
+/// none of the pool's threads are free, (or if it is called from one of
+/// them).
+template <typename Fn>
+void parallel_chunks(ThreadPool &pool, std::size_t total, std::size_t grain,
+                     Fn &fn)
+{
+    if (total == 0) {
+        return;
+    }
+    auto threads = pool.size();
+    auto job = std::make_shared<ParallelJob>(total, grain, threads + 1);
+    auto helpers = std::min(threads, (total - 1) / std::max<std::size_t>(grain, 1));
+
+    // A helper which starts late may find nothing left to claim, in which
+    // case it never touches fn, (which may by then have gone out of scope).
+    auto chunk = [&fn](std::size_t begin, std::size_t end) { fn(begin, end); };
+    using Chunk = decltype(chunk);
+    std::vector<ThreadPool::Task> tasks;
+    tasks.reserve(helpers);
+    for (auto i = 0u; i < helpers; ++i) {
+        tasks.emplace_back([job, chunk]() mutable { job->run(chunk); });
+    }
+    pool.addTasks(std::move(tasks));
+
+    Chunk mine = chunk;
+    job->run(mine);
+    job->wait();
+}
+
+} // namespace detail
+
+/// Call fn for every value in [first, last), spread across the threads of
+/// the pool.  The calling thread takes part, rather than just waiting.
+/// @param pool The ThreadPool to run on.
+/// @param first,last The range.  These may be integers, in which case fn is
+/// called with each integer in the range, or random access iterators, in
+/// which case fn is called with each element.
+/// @param fn The function to call.  It may be called concurrently.
+/// @param grain The smallest number of values to hand to a thread at once.
+/// This should be large enough that a chunk outweighs the cost of
+/// scheduling it.
+/// @throw Rethrows the first exception thrown by fn, once every chunk which
+/// was started has finished.
+/// @par Example
+/// @code
+///     std::vector<double> v(1000000);
+///     parallel_for(pool, 0u, v.size(), [&v](std::size_t i) { v[i] = sqrt(i); }, 1024);
+/// @endcode
+template <typename Index, typename Fn>
+void parallel_for(ThreadPool &pool, Index first, Index last, Fn &&fn,
+                  std::size_t grain = 1)
+{
+    auto chunk = [&first, &fn](std::size_t begin, std::size_t end)
+    {
+        for (auto i = begin; i < end; ++i) {
+            fn(detail::parallel_at(first, i));
+        }
+    };
+    detail::parallel_chunks(pool, detail::parallel_distance(first, last),
+                            grain, chunk);
+}
+
+/// Reduce the values in [first, last) with op, spread across the threads of
+/// the pool.  The calling thread takes part, rather than just waiting.
+/// As with std::reduce, op must be associative.  The partial results of the
+/// chunks are combined in order, so op need not be commutative, and the
+/// result is the same from one run to the next.
+/// @param pool The ThreadPool to run on.
+/// @param first,last The range.  These may be integers, or random access
+/// iterators, as for parallel_for().
+/// @param init The initial value, which is combined with the result.
+/// @param op The reduction, called as op(T, T) and op(T, value).
+/// @param grain The smallest number of values to hand to a thread at once.
+/// @return init combined with every value in the range.
+/// @par Example
+/// @code
+///     auto sum = parallel_reduce(pool, v.begin(), v.end(), 0, std::plus<>(), 1024);
+/// @endcode
+template <typename Index, typename T, typename Op>
+T parallel_reduce(ThreadPool &pool, Index first, Index last, T init, Op &&op,
+                  std::size_t grain = 1)
+{
+    std::mutex mutex;
+    std::vector<std::pair<std::size_t, T>> partials;
+    auto chunk = [&](std::size_t begin, std::size_t end)
+    {
+        T acc = detail::parallel_at(first, begin);
+        for (auto i = begin + 1; i < end; ++i) {
+            acc = op(std::move(acc), detail::parallel_at(first, i));
+        }
+        std::lock_guard<std::mutex> l(mutex);
+        partials.emplace_back(begin, std::move(acc));
+    };
+    detail::parallel_chunks(pool, detail::parallel_distance(first, last),
+                            grain, chunk);
+
+    std::sort(partials.begin(), partials.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (auto &p : partials) {
+        init = op(std::move(init), std::move(p.second));
+    }
+    return init;
+}
+
+} // namespace CompuBrite
+#endif // COMPUBRITE_PARALLEL_H_INCLUDED
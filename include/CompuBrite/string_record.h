@@ -26,15 +26,26 @@
 #ifndef COMPUBRITE_STRING_RECORD_H_INCLUDED
 #define COMPUBRITE_STRING_RECORD_H_INCLUDED
 
+#include <CompuBrite/header_only.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <iterator>
 #include <string>
 #include <string_view>
 #include <vector>
-#include <unordered_map>
 
 namespace CompuBrite {
 
+class string_pool;
+class ThreadPool;
+
 /// A string_record keeps track of unique strings and provides a simple means
-/// of referring to them.
+/// of referring to them.  Each string_record belongs to a string_pool; the
+/// static from_string() functions use string_pool::global(), which lasts as
+/// long as the process does.
 class string_record
 {
 public:
@@ -49,37 +60,332 @@ public:
     /// of that string, create a new string_record and return that.
     static string_record from_string(const std::string &str);
 
+    /// @return a string_record from the given string.  If there is no record
+    /// of that string, create a new string_record and return that.  Looking
+    /// up a string which has been recorded already doesn't allocate, so this
+    /// suits slices of a larger buffer, (such as a tokenizer's).
+    static string_record from_string(std::string_view str);
+
+    /// @return a string_record from the given null terminated string.
+    static string_record from_string(const char *str)
+    {
+        return from_string(std::string_view(str));
+    }
+
     /// @return the index for this string_record.  This is it's index into
     /// the string repository.
     size_t index() const                         { return _index; }
 
-    /// @return a string_view associated with this string_record
-    std::string_view string_view() const         { return _strings[_index]; }
+    /// @return the string_pool this string_record belongs to.
+    const string_pool& pool() const              { return *_pool; }
+
+    /// @return a string_view associated with this string_record.  The
+    /// characters are followed by a '\0', so data() may be used as a C
+    /// string.
+    std::string_view string_view() const;
+
+    /// @return a copy of the string associated with this string_record.
+    /// string_view() is cheaper, where it will do.
+    std::string string() const                   { return std::string(string_view()); }
+
+    /// @return the hash of the string associated with this string_record,
+    /// (the same as fast_hash() gives for it).  It is kept
+    /// with the string, so this doesn't hash it again.
+    size_t hash() const;
+
+private:
+    friend class string_pool;
+
+    /// string_record objects should only be created from the factory
+    /// functions: from_string(), or string_pool::from_string()
+    string_record(const string_pool *pool, size_t index) :
+        _pool(pool),
+        _index(index)
+    { }
+
+private:
+    const string_pool  *_pool;
+    size_t              _index;
+};
+
+/// A string_pool holds a set of unique strings, each of which is referred to
+/// by a string_record.  A pool may be made for each document, (say), so that
+/// its strings are all freed together when it is destroyed, (after which its
+/// string_records must no longer be used).
+///
+/// Strings may be recorded from any number of threads.  The pool is split
+/// into shards by hash, each with its own lock, and looking up a string which
+/// has already been recorded takes no lock at all.  The indices are dense,
+/// (from 0 up to the number of strings recorded), and never change.
+///
+/// Each string is stored once, in an arena which is only freed along with the
+/// pool, so the string_view for a string_record stays valid as long as its
+/// pool does.  There may be up to 2^32 - 1 strings in a pool.
+///
+/// A pool may be saved to a file, and later mapped from it, (with map()),
+/// which gives the same indices without copying any strings.  Strings added
+/// to a mapped pool go into the pool as usual.
+class string_pool
+{
+public:
+    /// The number of shards in the global pool, and by default.
+    static constexpr size_t DefaultShards = 64;
+
+    /// Construct an empty pool.
+    /// @param shards The number of shards, (rounded up to a power of two).
+    /// One will do for a pool which is only used from one thread at a time.
+    explicit string_pool(size_t shards = DefaultShards);
+    ~string_pool();
+
+    string_pool(const string_pool &) = delete;
+    string_pool& operator=(const string_pool &) = delete;
+
+    /// @return the pool used by string_record::from_string().  It is never
+    /// destroyed.
+    static string_pool& global();
+
+    /// Replace the global pool, (typically with one from map()), before it
+    /// is first used.
+    /// @return false, (and leave the global pool alone), if it has already
+    /// been used.
+    static bool set_global(std::unique_ptr<string_pool> pool);
+
+    /// @return a pool holding the strings in a file written by save(), with
+    /// the same indices.  The file is mapped read-only; the strings are not
+    /// copied, and nothing is allocated for each of them.
+    /// @param shards The number of shards for strings added later.
+    /// @throw std::runtime_error if the file can't be mapped, or isn't one
+    /// written by save().
+    static std::unique_ptr<string_pool> map(const std::string &path,
+                                            size_t shards = DefaultShards);
+
+    /// Write the strings in this pool to a file, for map().  The file holds
+    /// a table of offsets, the strings, their hashes, and a hash index.
+    /// Strings must not be added to the pool while it is being saved.
+    /// @throw std::runtime_error if the file can't be written.
+    void save(const std::string &path) const;
+
+    /// @return a string_record from the given string.  If there is no record
+    /// of that string in this pool, create a new string_record and return
+    /// that.
+    string_record from_string(std::string_view str);
+
+    string_record from_string(const std::string &str)
+    {
+        return from_string(std::string_view(str));
+    }
+
+    string_record from_string(const char *str)
+    {
+        return from_string(std::string_view(str));
+    }
+
+    /// Record many strings at once.  This is quicker than calling
+    /// from_string() for each of them; each Shard is grown just once, and
+    /// the strings may be hashed and looked up in parallel.  The strings
+    /// which are new are recorded in order.
+    /// @param strs The strings to record.
+    /// @param pool If given, the ThreadPool to hash and look up strings on.
+    /// @return the string_records, in the same order as the strings.
+    std::vector<string_record> from_strings(const std::vector<std::string_view> &strs,
+                                            ThreadPool *pool = nullptr);
+
+    /// Record each of the strings in a range, (of anything which converts
+    /// to a string_view), as for from_strings() above.
+    template <typename Range>
+    std::vector<string_record> from_strings(const Range &range,
+                                            ThreadPool *pool = nullptr)
+    {
+        std::vector<std::string_view> strs;
+        strs.reserve(static_cast<size_t>(
+            std::distance(std::begin(range), std::end(range))));
+        for (const auto &str : range) {
+            strs.emplace_back(str);
+        }
+        return from_strings(strs, pool);
+    }
+
+    /// @return the number of strings in this pool.
+    size_t size() const
+    {
+        return _base + _count.load(std::memory_order_acquire);
+    }
+
+private:
+    friend class string_record;
+    friend class string_ranks;
+
+    /// A recorded string.  Entries never move once they have been made.
+    struct Entry
+    {
+        std::string_view    string;
+        size_t              hash{0};
+    };
+
+    class Arena;
+    struct Table;
+    struct Shard;
+    struct Image;
+
+    /// @return the string_record for str, recording it if need be.
+    /// @param hash The hash of str.
+    string_record intern(std::string_view str, size_t hash);
+
+    /// @return the index of a string which has been recorded, or npos.
+    size_t find(std::string_view str, size_t hash) const;
 
-    /// @return a const reference to the string associated with this
-    /// string_record
-    const std::string& string() const            { return _strings[_index]; }
+    /// @return the Shard in which a string with the given hash is recorded.
+    Shard& shard(size_t hash) const;
+
+    /// Make room in a Shard's Table for more entries.  The Shard's lock
+    /// must be held.
+    /// @return the Shard's Table.
+    Table& grow(Shard &s, size_t more);
+
+    /// @return the entry with the given index, making its segment if need
+    /// be.  The caller must have claimed the index.  The entries are
+    /// numbered from 0, after the strings in the Image.
+    Entry& make(size_t index);
+
+    /// @return the string with the given index, which may be in the Image.
+    std::string_view view(size_t index) const
+    {
+        if (index < _base) {
+            auto begin = _offsets[index];
+            return std::string_view(_blob + begin, _offsets[index + 1] - begin - 1);
+        }
+        return entry(index - _base).string;
+    }
+
+    /// @return the hash of the string with the given index.
+    size_t hash_of(size_t index) const
+    {
+        return index < _base ? static_cast<size_t>(_hashes[index])
+                             : entry(index - _base).hash;
+    }
+
+    /// @return the entry with the given index, which must have been made.
+    const Entry& entry(size_t index) const
+    {
+        size_t offset;
+        auto k = segment(index, offset);
+        return _segments[k].load(std::memory_order_acquire)[offset];
+    }
+
+    /// @return the segment holding the entry with the given index.
+    /// @param offset Set to the offset of the entry within the segment.
+    static size_t segment(size_t index, size_t &offset)
+    {
+        // Segment k holds FirstSegment << k entries, starting at index
+        // FirstSegment * (2^k - 1).
+        auto n = index / FirstSegment + 1;
+#if defined(__GNUC__)
+        size_t k = sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(n);
+#else
+        size_t k = 0;
+        while (n >>= 1) {
+            ++k;
+        }
+#endif
+        offset = index - FirstSegment * ((size_t{1} << k) - 1);
+        return k;
+    }
 
 private:
-    /// string_record objects should only be created from the static
-    /// factory function: from_string()
-    string_record();
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    /// The entries are kept in segments, each twice the size of the one
+    /// before, so that they never move as more are made.
+    static constexpr size_t FirstSegment = 64;
+    static constexpr size_t Segments = sizeof(size_t) * 8 - 6;
 
+    std::atomic<Entry*>         _segments[Segments]{};
+    std::atomic<size_t>         _count{0};
+    size_t                      _shardBits;
+    std::unique_ptr<Shard[]>    _shards;
+
+    /// The strings mapped from a file, if any, which take the first _base
+    /// indices.  The arrays are copied from the Image for view() and
+    /// hash_of().
+    std::unique_ptr<Image>      _image;
+    const std::uint64_t        *_offsets{nullptr};
+    const std::uint64_t        *_hashes{nullptr};
+    const char                 *_blob{nullptr};
+    size_t                      _base{0};
+};
+
+inline std::string_view
+string_record::string_view() const
+{
+    return _pool->view(_index);
+}
+
+inline size_t
+string_record::hash() const
+{
+    return _pool->hash_of(_index);
+}
+
+/// The rank of each string in a string_pool, in lexicographic order, for
+/// the strings in the pool when the string_ranks was made.  Sorting by rank
+/// orders string_records by their strings, without comparing the strings.
+class string_ranks
+{
+public:
+    /// Rank the strings in a pool.  Strings must not be added to the pool
+    /// while it is being ranked.
+    explicit string_ranks(const string_pool &pool);
+
+    /// @return the pool whose strings are ranked.
+    const string_pool& pool() const              { return *_pool; }
+
+    /// @return true if the string_record's string has been ranked.
+    bool ranked(const string_record &r) const
+    {
+        return &r.pool() == _pool && r.index() < _ranks.size();
+    }
+
+    /// @return the rank of a string_record's string, which must have been
+    /// ranked.
+    std::uint32_t operator[](const string_record &r) const
+    {
+        return _ranks[r.index()];
+    }
 
 private:
-    size_t _index;
+    const string_pool          *_pool;
+    std::vector<std::uint32_t>  _ranks;
+};
+
+/// A comparator which orders string_records by their strings.  Given a
+/// string_ranks, it compares the ranks of the strings which have been
+/// ranked, and only compares the strings of those which haven't.
+class string_less
+{
+public:
+    string_less() = default;
 
-    using Strings = std::vector<std::string>;
-    using Map = std::unordered_map<std::string, string_record>;
+    /// @param ranks The ranks to use, which must outlive the string_less.
+    explicit string_less(const string_ranks &ranks) :
+        _ranks(&ranks)
+    { }
 
-    static Strings _strings;
-    static Map _map;
+    bool operator()(const string_record &lhs, const string_record &rhs) const
+    {
+        if (_ranks && _ranks->ranked(lhs) && _ranks->ranked(rhs)) {
+            return (*_ranks)[lhs] < (*_ranks)[rhs];
+        }
+        return lhs.string_view() < rhs.string_view();
+    }
+
+private:
+    const string_ranks *_ranks{nullptr};
 };
 
 bool
 inline operator==(string_record lhs, string_record rhs)
 {
-    return lhs.index() == rhs.index();
+    return lhs.index() == rhs.index() && &lhs.pool() == &rhs.pool();
 }
 
 } // namespace CompuBrite
@@ -96,4 +402,8 @@ namespace std
     };
 }
 
+#ifdef CBI_HEADER_ONLY
+#include <CompuBrite/string_record.ipp>
+#endif
+
 #endif // COMPUBRITE_STRING_RECORD_H_INCLUDED
@@ -0,0 +1,693 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief Implementation for string_record and string_pool.  This is
+ * compiled into the library by string_record.cpp, or included by
+ * string_record.h if CBI_HEADER_ONLY is defined.
+*/
+
+#ifndef COMPUBRITE_STRING_RECORD_IPP_INCLUDED
+#define COMPUBRITE_STRING_RECORD_IPP_INCLUDED
+
+#include <CompuBrite/string_record.h>
+#include <CompuBrite/fast_hash.h>
+#include <CompuBrite/parallel.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace CompuBrite {
+
+/// A bump pointer arena for the characters of the strings in a Shard.  The
+/// characters are copied into chunks, which are never moved, and only freed
+/// along with the pool, (only the Shard's lock is needed to add to an Arena).
+/// The chunks start small, so that a small pool stays small, and double in
+/// size up to MaxChunk.
+class string_pool::Arena
+{
+public:
+    /// @return a copy of str, followed by a '\0', in the arena.
+    std::string_view store(std::string_view str)
+    {
+        auto n = str.size() + 1;
+        if (n > _left) {
+            // Make room for the new chunk before taking it, so that a
+            // failure leaves the Arena as it was.
+            _chunks.reserve(_chunks.size() + 1);
+
+            // Strings too big to share a chunk get one to themselves, so
+            // the rest of the current chunk isn't wasted.
+            if (n > MaxChunk / 4) {
+                _chunks.emplace_back(new char[n]);
+                return copy(_chunks.back().get(), str);
+            }
+            auto size = std::min(_chunk * 2, MaxChunk);
+            while (size < n) {
+                size *= 2;
+            }
+            _next = new char[size];
+            _chunks.emplace_back(_next);
+            _chunk = _left = size;
+        }
+        auto result = copy(_next, str);
+        _next += n;
+        _left -= n;
+        return result;
+    }
+
+    /// Make sure there are at least n bytes to store strings in, (counting
+    /// their '\0's), in a single chunk if need be.
+    void reserve(size_t n)
+    {
+        if (n > _left) {
+            _chunks.reserve(_chunks.size() + 1);
+            _next = new char[n];
+            _chunks.emplace_back(_next);
+            _left = n;
+        }
+    }
+
+private:
+    static std::string_view copy(char *dst, std::string_view str)
+    {
+        std::memcpy(dst, str.data(), str.size());
+        dst[str.size()] = '\0';
+        return std::string_view(dst, str.size());
+    }
+
+    static constexpr size_t FirstChunk = 256;
+    static constexpr size_t MaxChunk = 64 * 1024;
+
+    char                                   *_next{nullptr};
+    size_t                                  _left{0};
+    size_t                                  _chunk{FirstChunk / 2};
+    std::vector<std::unique_ptr<char[]>>    _chunks;
+};
+
+/// An open addressed hash table of the entries in a Shard.  A Table is only
+/// written with its Shard's lock held, but may be read at any time.  Rather
+/// than growing in place, a Table is replaced by a larger copy.
+///
+/// Each slot holds the index of an entry plus one, (so 0 is empty), which
+/// takes half the room of a pointer.
+struct string_pool::Table
+{
+    using Slot = std::uint32_t;
+
+    /// The most entries there may be.
+    static constexpr size_t Limit = std::numeric_limits<Slot>::max();
+
+    explicit Table(size_t capacity) :
+        mask(capacity - 1),
+        slots(new std::atomic<Slot>[capacity]())
+    { }
+
+    /// @return the index of the entry for str, plus one, or 0 if it isn't in
+    /// this Table.
+    /// @param pool The pool holding the entries.
+    Slot find(const string_pool &pool, std::string_view str, size_t hash) const
+    {
+        for (auto i = hash & mask; ; i = (i + 1) & mask) {
+            auto slot = slots[i].load(std::memory_order_acquire);
+            if (!slot) {
+                return 0;
+            }
+            auto &e = pool.entry(slot - 1);
+            if (e.hash == hash && e.string == str) {
+                return slot;
+            }
+        }
+    }
+
+    /// Add the entry with the given index, which must not be in this Table
+    /// already.
+    void insert(size_t index, size_t hash)
+    {
+        auto i = hash & mask;
+        while (slots[i].load(std::memory_order_relaxed)) {
+            i = (i + 1) & mask;
+        }
+        slots[i].store(static_cast<Slot>(index + 1), std::memory_order_release);
+        ++size;
+    }
+
+    /// @return true if there is room for more entries in this Table.
+    bool fits(size_t more) const        { return (size + more) * 4 < (mask + 1) * 3; }
+
+    size_t mask;
+    size_t size{0};
+    std::unique_ptr<std::atomic<Slot>[]> slots;
+};
+
+/// A Shard of the record.  Its Tables are all kept, (the current one is the
+/// last), since a reader may still be probing one which has been replaced.
+struct alignas(64) string_pool::Shard
+{
+    static constexpr size_t FirstTable = 16;
+
+    std::mutex                          mutex;
+    std::atomic<const Table*>           table{nullptr};
+    std::vector<std::unique_ptr<Table>> tables;
+    Arena                               arena;
+};
+
+/// A snapshot of a pool, mapped from a file written by save().  The file
+/// starts with a Header, followed by the offset of each string in the blob,
+/// (plus one for the end), the hash of each string, the index, (an open
+/// addressed hash table of string index plus one), and the blob of
+/// characters, (each string followed by a '\0').
+struct string_pool::Image
+{
+    struct Header
+    {
+        char            magic[8];
+        std::uint32_t   version;
+        std::uint32_t   hashBits;
+        std::uint64_t   fingerprint;
+        std::uint64_t   count;
+        std::uint64_t   slots;
+        std::uint64_t   blob;
+    };
+
+    static constexpr char Magic[8] = {'C', 'B', 'I', 'P', 'O', 'O', 'L', '\0'};
+    static constexpr std::uint32_t Version = 1;
+
+    /// @return a hash which differs if the string hash does, (in which case
+    /// the hashes in a file can't be used).  fast_hash() is the same on
+    /// every machine, so this only differs for a file written by a version
+    /// which used another hash.
+    static std::uint64_t fingerprint()
+    {
+        return fast_hash("CompuBrite::string_pool");
+    }
+
+    /// @return the number of slots in the index for count strings.
+    static size_t slotsFor(size_t count)
+    {
+        size_t n = 16;
+        while (n < count * 2) {
+            n *= 2;
+        }
+        return n;
+    }
+
+    /// Fill in an index of the given hashes.
+    static void build(const std::uint64_t *hashes, size_t count,
+                      std::uint32_t *index, size_t slots)
+    {
+        auto mask = slots - 1;
+        for (size_t k = 0; k < count; ++k) {
+            auto i = hashes[k] & mask;
+            while (index[i]) {
+                i = (i + 1) & mask;
+            }
+            index[i] = static_cast<std::uint32_t>(k + 1);
+        }
+    }
+
+    ~Image()
+    {
+        if (data) {
+            ::munmap(data, length);
+        }
+    }
+
+    /// @return the string with the given index.
+    std::string_view view(size_t k) const
+    {
+        return std::string_view(blob + offsets[k], offsets[k + 1] - offsets[k] - 1);
+    }
+
+    /// @return the index of str, or npos if it isn't in this Image.
+    size_t find(std::string_view str, size_t hash) const
+    {
+        for (auto i = hash & mask; ; i = (i + 1) & mask) {
+            auto slot = index[i];
+            if (!slot) {
+                return npos;
+            }
+            if (hashes[slot - 1] == hash && view(slot - 1) == str) {
+                return slot - 1;
+            }
+        }
+    }
+
+    void                       *data{nullptr};
+    size_t                      length{0};
+    size_t                      count{0};
+    size_t                      mask{0};
+    const std::uint64_t        *offsets{nullptr};
+    const std::uint64_t        *hashes{nullptr};
+    const std::uint32_t        *index{nullptr};
+    const char                 *blob{nullptr};
+
+    /// The hashes and index, if those in the file were made by a different
+    /// hash.
+    std::vector<std::uint64_t>  ownHashes;
+    std::vector<std::uint32_t>  ownIndex;
+};
+
+namespace detail {
+
+/// The pool returned by string_pool::global(), once it has been made.
+CBI_INLINE std::atomic<string_pool*> globalPool{nullptr};
+
+} // namespace detail
+
+CBI_INLINE
+string_pool::string_pool(size_t shards) :
+    _shardBits(0)
+{
+    while ((size_t{1} << _shardBits) < shards) {
+        ++_shardBits;
+    }
+    _shards.reset(new Shard[size_t{1} << _shardBits]);
+}
+
+CBI_INLINE
+string_pool::~string_pool()
+{
+    // The entries don't need destroying, (they only refer to the Arenas).
+    for (auto &seg : _segments) {
+        ::operator delete(seg.load(std::memory_order_relaxed));
+    }
+}
+
+CBI_INLINE string_pool&
+string_pool::global()
+{
+    // Never destroyed, so that string_records may be used up to the end.
+    auto pool = detail::globalPool.load(std::memory_order_acquire);
+    if (!pool) {
+        auto fresh = new string_pool;
+        if (detail::globalPool.compare_exchange_strong(pool, fresh,
+                                               std::memory_order_acq_rel)) {
+            pool = fresh;
+        } else {
+            delete fresh;
+        }
+    }
+    return *pool;
+}
+
+CBI_INLINE bool
+string_pool::set_global(std::unique_ptr<string_pool> pool)
+{
+    string_pool *expected = nullptr;
+    if (!detail::globalPool.compare_exchange_strong(expected, pool.get(),
+                                            std::memory_order_acq_rel)) {
+        return false;
+    }
+    pool.release();
+    return true;
+}
+
+CBI_INLINE std::unique_ptr<string_pool>
+string_pool::map(const std::string &path, size_t shards)
+{
+    auto fail = [&path](const std::string &why)
+    {
+        return std::runtime_error("string_pool: " + path + ": " + why);
+    };
+
+    auto image = std::make_unique<Image>();
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw fail(std::strerror(errno));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+        auto error = errno;
+        ::close(fd);
+        throw fail(std::strerror(error));
+    }
+    image->length = static_cast<size_t>(st.st_size);
+    if (image->length < sizeof(Image::Header)) {
+        ::close(fd);
+        throw fail("not a string_pool snapshot");
+    }
+    auto data = ::mmap(nullptr, image->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw fail(std::strerror(errno));
+    }
+    image->data = data;
+
+    auto header = static_cast<const Image::Header*>(data);
+    auto count = header->count;
+    auto slots = header->slots;
+    if (std::memcmp(header->magic, Image::Magic, sizeof(Image::Magic)) ||
+        header->version != Image::Version) {
+        throw fail("not a string_pool snapshot");
+    }
+    // The index must be a power of two with room to spare, (as slotsFor()
+    // makes it).  Whether it really has an empty slot is checked below.
+    // The sizes come from the file, so they are checked without overflow.
+    if (count >= Table::Limit || slots < Image::slotsFor(count) ||
+        (slots & (slots - 1))) {
+        throw fail("corrupt string_pool snapshot");
+    }
+    auto left = image->length - sizeof(Image::Header);
+    auto arrays = (2 * count + 1) * 8;
+    if (arrays > left || slots > (left - arrays) / 4 ||
+        header->blob != left - arrays - slots * 4) {
+        throw fail("corrupt string_pool snapshot");
+    }
+
+    auto at = static_cast<const char*>(data) + sizeof(Image::Header);
+    image->count = count;
+    image->mask = slots - 1;
+    image->offsets = reinterpret_cast<const std::uint64_t*>(at);
+    at += (count + 1) * 8;
+    image->hashes = reinterpret_cast<const std::uint64_t*>(at);
+    at += count * 8;
+    image->index = reinterpret_cast<const std::uint32_t*>(at);
+    at += slots * 4;
+    image->blob = at;
+    if (image->offsets[count] != header->blob) {
+        throw fail("corrupt string_pool snapshot");
+    }
+    for (size_t k = 0; k < count; ++k) {
+        // Each string is followed by a '\0', so none of them is empty.
+        if (image->offsets[k] >= image->offsets[k + 1] ||
+            image->blob[image->offsets[k + 1] - 1] != '\0') {
+            throw fail("corrupt string_pool snapshot");
+        }
+    }
+
+    if (header->hashBits != sizeof(size_t) * 8 ||
+        header->fingerprint != Image::fingerprint()) {
+        // Written with a different hash, so hash the strings again.
+        image->ownHashes.resize(count);
+        for (size_t k = 0; k < count; ++k) {
+            image->ownHashes[k] = fast_hash(image->view(k));
+        }
+        image->ownIndex.resize(slots);
+        Image::build(image->ownHashes.data(), count, image->ownIndex.data(), slots);
+        image->hashes = image->ownHashes.data();
+        image->index = image->ownIndex.data();
+    } else {
+        // Each string must be in the index exactly once, so the rest of the
+        // slots are empty and a lookup which misses always stops.
+        std::vector<bool> indexed(count + 1);
+        for (size_t i = 0; i < slots; ++i) {
+            auto k = image->index[i];
+            if (k > count || (k && indexed[k])) {
+                throw fail("corrupt string_pool snapshot");
+            }
+            indexed[k] = true;
+        }
+        if (!indexed[0]) {
+            throw fail("corrupt string_pool snapshot");
+        }
+        for (size_t k = 1; k <= count; ++k) {
+            if (!indexed[k]) {
+                throw fail("corrupt string_pool snapshot");
+            }
+        }
+    }
+
+    auto pool = std::make_unique<string_pool>(shards);
+    pool->_offsets = image->offsets;
+    pool->_hashes = image->hashes;
+    pool->_blob = image->blob;
+    pool->_base = count;
+    pool->_image = std::move(image);
+    return pool;
+}
+
+CBI_INLINE void
+string_pool::save(const std::string &path) const
+{
+    auto count = size();
+    Image::Header header{};
+    std::memcpy(header.magic, Image::Magic, sizeof(Image::Magic));
+    header.version = Image::Version;
+    header.hashBits = sizeof(size_t) * 8;
+    header.fingerprint = Image::fingerprint();
+    header.count = count;
+    header.slots = Image::slotsFor(count);
+
+    std::vector<std::uint64_t> offsets(count + 1);
+    std::vector<std::uint64_t> hashes(count);
+    std::uint64_t at = 0;
+    for (size_t i = 0; i < count; ++i) {
+        offsets[i] = at;
+        at += view(i).size() + 1;
+        hashes[i] = hash_of(i);
+    }
+    offsets[count] = at;
+    header.blob = at;
+
+    std::vector<std::uint32_t> index(header.slots);
+    Image::build(hashes.data(), count, index.data(), header.slots);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * 8);
+    out.write(reinterpret_cast<const char*>(hashes.data()), hashes.size() * 8);
+    out.write(reinterpret_cast<const char*>(index.data()), index.size() * 4);
+    for (size_t i = 0; i < count; ++i) {
+        // Every string is followed by a '\0' already.
+        auto str = view(i);
+        out.write(str.data(), str.size() + 1);
+    }
+    out.close();
+    if (!out) {
+        throw std::runtime_error("string_pool: " + path + ": cannot write");
+    }
+}
+
+CBI_INLINE string_pool::Shard&
+string_pool::shard(size_t hash) const
+{
+    // The Tables use the low bits of the hash, so the Shards use the high.
+    if (!_shardBits) {
+        return _shards[0];
+    }
+    return _shards[hash >> (sizeof(size_t) * 8 - _shardBits)];
+}
+
+CBI_INLINE string_pool::Table&
+string_pool::grow(Shard &s, size_t more)
+{
+    auto table = s.tables.empty() ? nullptr : s.tables.back().get();
+    if (table && table->fits(more)) {
+        return *table;
+    }
+    auto capacity = table ? (table->mask + 1) * 2 : Shard::FirstTable;
+    auto needed = (table ? table->size : 0) + more;
+    while (needed * 4 >= capacity * 3) {
+        capacity *= 2;
+    }
+    auto bigger = std::make_unique<Table>(capacity);
+    if (table) {
+        for (auto i = 0u; i <= table->mask; ++i) {
+            if (auto slot = table->slots[i].load(std::memory_order_relaxed)) {
+                bigger->insert(slot - 1, entry(slot - 1).hash);
+            }
+        }
+    }
+    s.tables.emplace_back(std::move(bigger));
+    table = s.tables.back().get();
+    s.table.store(table, std::memory_order_release);
+    return *table;
+}
+
+CBI_INLINE string_pool::Entry&
+string_pool::make(size_t index)
+{
+    size_t offset;
+    auto k = segment(index, offset);
+    auto seg = _segments[k].load(std::memory_order_acquire);
+    if (!seg) {
+        // Another Shard may be making the same segment; the first one wins.
+        // Segments last as long as the pool does.  The entries are only
+        // constructed as they are made, so the pages of a large segment
+        // aren't touched until they are needed.
+        auto fresh = static_cast<Entry*>(
+            ::operator new(sizeof(Entry) * (FirstSegment << k)));
+        if (_segments[k].compare_exchange_strong(seg, fresh,
+                                                 std::memory_order_acq_rel)) {
+            seg = fresh;
+        } else {
+            ::operator delete(fresh);
+        }
+    }
+    return *::new (static_cast<void*>(seg + offset)) Entry;
+}
+
+CBI_INLINE
+string_ranks::string_ranks(const string_pool &pool) :
+    _pool(&pool),
+    _ranks(pool.size())
+{
+    std::vector<std::uint32_t> order(_ranks.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = static_cast<std::uint32_t>(i);
+    }
+    std::sort(order.begin(), order.end(), [&pool](auto lhs, auto rhs)
+        {
+            return pool.view(lhs) < pool.view(rhs);
+        });
+    for (size_t rank = 0; rank < order.size(); ++rank) {
+        _ranks[order[rank]] = static_cast<std::uint32_t>(rank);
+    }
+}
+
+CBI_INLINE string_record
+string_record::from_string(const std::string &str)
+{
+    return from_string(std::string_view(str));
+}
+
+CBI_INLINE string_record
+string_record::from_string(std::string_view str)
+{
+    return string_pool::global().from_string(str);
+}
+
+CBI_INLINE string_record
+string_pool::from_string(std::string_view str)
+{
+    // The hash is computed once, and kept for both the lock free lookup and
+    // the locked insert, (and in the entry, for when its Table is replaced).
+    return intern(str, static_cast<size_t>(fast_hash(str)));
+}
+
+CBI_INLINE std::vector<string_record>
+string_pool::from_strings(const std::vector<std::string_view> &strs,
+                          ThreadPool *pool)
+{
+    // Hash the strings, and look for those already recorded, which needs no
+    // lock, so it may be done in parallel.
+    auto n = strs.size();
+    std::vector<size_t> hashes(n);
+    std::vector<size_t> found(n);
+    auto lookup = [&](size_t i)
+    {
+        hashes[i] = static_cast<size_t>(fast_hash(strs[i]));
+        found[i] = find(strs[i], hashes[i]);
+    };
+    if (pool) {
+        parallel_for(*pool, size_t{0}, n, lookup, 1024);
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            lookup(i);
+        }
+    }
+
+    // Make room for the new strings, taking each Shard's lock just once.
+    auto shards = size_t{1} << _shardBits;
+    std::vector<size_t> counts(shards);
+    std::vector<size_t> bytes(shards);
+    for (size_t i = 0; i < n; ++i) {
+        if (found[i] == npos) {
+            auto k = static_cast<size_t>(&shard(hashes[i]) - _shards.get());
+            ++counts[k];
+            bytes[k] += strs[i].size() + 1;
+        }
+    }
+    for (size_t k = 0; k < shards; ++k) {
+        if (counts[k]) {
+            auto &s = _shards[k];
+            std::lock_guard<std::mutex> l(s.mutex);
+            grow(s, counts[k]);
+            s.arena.reserve(bytes[k]);
+        }
+    }
+
+    std::vector<string_record> records;
+    records.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        records.push_back(found[i] != npos ? string_record(this, found[i])
+                                           : intern(strs[i], hashes[i]));
+    }
+    return records;
+}
+
+CBI_INLINE size_t
+string_pool::find(std::string_view str, size_t hash) const
+{
+    if (_image) {
+        auto index = _image->find(str, hash);
+        if (index != npos) {
+            return index;
+        }
+    }
+    if (auto table = shard(hash).table.load(std::memory_order_acquire)) {
+        if (auto slot = table->find(*this, str, hash)) {
+            return _base + slot - 1;
+        }
+    }
+    return npos;
+}
+
+CBI_INLINE string_record
+string_pool::intern(std::string_view str, size_t hash)
+{
+    // Most strings have been recorded already, which needs no lock.
+    auto found = find(str, hash);
+    if (found != npos) {
+        return string_record(this, found);
+    }
+
+    auto &s = shard(hash);
+    std::lock_guard<std::mutex> l(s.mutex);
+    if (!s.tables.empty()) {
+        // Another thread may have recorded it since.
+        if (auto slot = s.tables.back()->find(*this, str, hash)) {
+            return string_record(this, _base + slot - 1);
+        }
+    }
+    auto &table = grow(s, 1);
+
+    // Copy the string before claiming an index, so that a failure doesn't
+    // leave a gap.
+    auto stored = s.arena.store(str);
+    auto index = _count.fetch_add(1, std::memory_order_relaxed);
+    if (_base + index >= Table::Limit) {
+        _count.fetch_sub(1, std::memory_order_relaxed);
+        throw std::length_error("string_pool: too many strings");
+    }
+    auto &e = make(index);
+    e.string = stored;
+    e.hash = hash;
+    table.insert(index, hash);
+    return string_record(this, _base + index);
+}
+
+} // namespace CompuBrite
+#endif // COMPUBRITE_STRING_RECORD_IPP_INCLUDED
@@ -1,7 +1,9 @@
 #ifndef COMPUBRITE_TYPE_MAP_H_INCLUDED
 #define COMPUBRITE_TYPE_MAP_H_INCLUDED
 
+#include <cstddef>
 #include <type_traits>
+#include <utility>
 
 namespace CompuBrite {
 
@@ -17,43 +19,136 @@ struct pair {
     using second_type = V;
 };
 
-template<typename Pair>
+/// An entry of a type_map, at position I.  Looking a key up is overload
+/// resolution on these, so it instantiates nothing for each entry.
+template<typename Pair, std::size_t I = 0>
 struct type_map_element
 {
     static auto value(type_tag<typename Pair::first_type>) -> type_tag<typename Pair::second_type>;
+    static auto index(type_tag<typename Pair::first_type>) -> std::integral_constant<std::size_t, I>;
 };
 
+template< typename T, std::size_t I = 0 >
+struct type_set_element
+{
+    static auto value(type_tag< T >) -> type_tag< T >;
+    static auto index(type_tag< T >) -> std::integral_constant<std::size_t, I>;
+};
+
+namespace detail {
+
+template<typename Seq, typename... elems>
+struct type_map_base;
+
+/// The entries of a type_map, numbered.  A key which isn't there matches
+/// index(...), which gives the number of entries, but no value(), (the one
+/// here only makes the name known, for an empty map).
+template<std::size_t... Is, typename... elems>
+struct type_map_base<std::index_sequence<Is...>, elems...> : type_map_element<elems, Is>...
+{
+    using type_map_element<elems, Is>::value...;
+    using type_map_element<elems, Is>::index...;
+
+    static void value();
+    static auto index(...) -> std::integral_constant<std::size_t, sizeof...(elems)>;
+};
+
+template<typename Seq, typename... elems>
+struct type_set_base;
+
+template<std::size_t... Is, typename... elems>
+struct type_set_base<std::index_sequence<Is...>, elems...> : type_set_element<elems, Is>...
+{
+    using type_set_element<elems, Is>::value...;
+    using type_set_element<elems, Is>::index...;
+
+    static void value();
+    static auto index(...) -> std::integral_constant<std::size_t, sizeof...(elems)>;
+};
+
+/// The result of calling Fn with the tags of the first entry of a type_map.
+template<typename Fn, typename Pair = pair<void, void>, typename... Rest>
+struct type_map_result
+{
+    using type = std::invoke_result_t<Fn&, type_tag<typename Pair::first_type>,
+                                      type_tag<typename Pair::second_type> >;
+};
+
+/// Call fn with the tags of a type_map's entry, (for type_map::dispatch()).
+template<typename R, typename Fn, typename Pair>
+R type_map_call(Fn &fn)
+{
+    return fn(type_tag<typename Pair::first_type>{}, type_tag<typename Pair::second_type>{});
+}
+
+} // namespace detail
+
 template<typename... elems>
-struct type_map : type_map_element<elems>...
+struct type_map : detail::type_map_base<std::index_sequence_for<elems...>, elems...>
 {
-    using type_map_element<elems>::value...;
+    /// The number of entries.
+    static constexpr std::size_t size = sizeof...(elems);
 
     template<typename K>
     using find = typename decltype(type_map::value(type_tag<K>{}))::type;
 
+    /// The position of the entry for K, (or size if there is none), which
+    /// may be used as a run-time id for K, for dispatch().
+    template<typename K>
+    static constexpr std::size_t index_of = decltype(type_map::index(type_tag<K>{}))::value;
+
     template <typename K >
     static constexpr bool has()
     {
-        return std::bool_constant< (std::is_same_v<K, typename elems::first_type> || ...) > ::value;
+        return index_of<K> != size;
     }
-};
 
-template< typename T >
-struct type_set_element
-{
-    static auto value(type_tag< T >) -> type_tag< T >;
-};
+    /// Call fn(type_tag<K>{}, type_tag<V>{}) for each entry, in order.
+    template<typename Fn>
+    static constexpr void for_each(Fn &&fn)
+    {
+        (fn(type_tag<typename elems::first_type>{}, type_tag<typename elems::second_type>{}), ...);
+    }
 
+    /// Call fn(type_tag<K>{}, type_tag<V>{}) for the entry at a position
+    /// known only at run-time, through a table of functions, (one for each
+    /// entry), rather than a chain of comparisons.  fn must return the same
+    /// type for every entry.
+    /// @param index The position, (from index_of), which must be less than
+    /// size.
+    /// @par Example
+    /// @code
+    ///     // Each Message records Handlers::index_of its own type.
+    ///     Handlers::dispatch(msg.id(), [&](auto key, auto handler) {
+    ///         using Type = typename decltype(key)::type;
+    ///         typename decltype(handler)::type{}(static_cast<Type&>(msg));
+    ///     });
+    /// @endcode
+    template<typename Fn>
+    static decltype(auto) dispatch(std::size_t index, Fn &&fn)
+    {
+        static_assert(size > 0, "dispatch() needs at least one entry");
+        using F = std::remove_reference_t<Fn>;
+        using R = typename detail::type_map_result<F, elems...>::type;
+        static constexpr R (*table[])(F&) = {&detail::type_map_call<R, F, elems>...};
+        return table[index](fn);
+    }
+};
 
 template<typename... elems>
-struct type_set : type_set_element< elems >...
+struct type_set : detail::type_set_base<std::index_sequence_for<elems...>, elems...>
 {
-    using type_set_element< elems >::value...;
+    /// The number of elements.
+    static constexpr std::size_t size = sizeof...(elems);
+
+    /// The position of K, (or size if it isn't in the set).
+    template<typename K>
+    static constexpr std::size_t index_of = decltype(type_set::index(type_tag<K>{}))::value;
 
     template< typename K >
     static constexpr bool has()
     {
-        return std::bool_constant< (std::is_same_v<K, elems > || ...) > ::value;
+        return index_of<K> != size;
     }
 };
 
@@ -0,0 +1,169 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief CompuBrite::visit, which visits std::variants through a flat switch,
+ * or a table of functions.
+*/
+
+#ifndef COMPUBRITE_VISIT_H_INCLUDED
+#define COMPUBRITE_VISIT_H_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace CompuBrite
+{
+
+namespace detail
+{
+
+template<typename V>
+constexpr std::size_t visit_size = std::variant_size_v<std::remove_cv_t<std::remove_reference_t<V> > >;
+
+/// @return alternative I of a variant which is known to hold it, (with the
+/// variant's value category).  The compiler is told that the variant holds
+/// it, so that std::get doesn't check the index again.
+template<std::size_t I, typename V>
+decltype(auto) visit_get(V &&v)
+{
+#if defined(__GNUC__)
+    if (v.index() != I) {
+        __builtin_unreachable();
+    }
+#endif
+    return std::get<I>(std::forward<V>(v));
+}
+
+/// The most combinations of alternatives visit() handles with a switch,
+/// (beyond which it uses a table of functions).
+constexpr std::size_t VisitSwitchLimit = 64;
+
+/// Visiting variants Vs with Fn, returning R.  The alternatives of the
+/// variants are numbered together, (in mixed radix, with the last variant
+/// varying fastest), and each number has a function which gets those
+/// alternatives and calls fn.
+template<typename R, typename Fn, typename Seq, typename... Vs>
+struct Visitor;
+
+template<typename R, typename Fn, std::size_t... Ks, typename... Vs>
+struct Visitor<R, Fn, std::index_sequence<Ks...>, Vs...>
+{
+    static constexpr std::size_t sizes[] = {visit_size<Vs>...};
+    static constexpr std::size_t count = (visit_size<Vs> * ... * 1);
+
+    /// @return the alternative of variant K in combination Flat.
+    template<std::size_t Flat, std::size_t K>
+    static constexpr std::size_t alternative()
+    {
+        std::size_t stride = 1;
+        for (std::size_t k = K + 1; k < sizeof...(Vs); ++k) {
+            stride *= sizes[k];
+        }
+        return Flat / stride % sizes[K];
+    }
+
+    template<std::size_t Flat>
+    static R call(Fn &&fn, Vs &&...vs)
+    {
+        return std::invoke(std::forward<Fn>(fn),
+                           visit_get<alternative<Flat, Ks>()>(std::forward<Vs>(vs))...);
+    }
+
+    template<std::size_t... Flats>
+    static constexpr auto make_table(std::index_sequence<Flats...>)
+    {
+        return std::array<R (*)(Fn&&, Vs&&...), count>{{&call<Flats>...}};
+    }
+
+    static R visit(Fn &&fn, Vs &&...vs)
+    {
+        if ((vs.valueless_by_exception() || ...)) {
+            throw std::bad_variant_access();
+        }
+        std::size_t flat = 0;
+        ((flat = flat * sizes[Ks] + vs.index()), ...);
+
+        if constexpr (count <= VisitSwitchLimit) {
+            // A switch, (rather than calls through pointers), so that the
+            // compiler can inline fn into each case.
+            switch (flat) {
+#define CBI_VISIT_CASE(n)                                                   \
+            case n:                                                         \
+                if constexpr (n < count) {                                  \
+                    return call<n>(std::forward<Fn>(fn), std::forward<Vs>(vs)...); \
+                }                                                           \
+                break;
+#define CBI_VISIT_CASES8(n) \
+            CBI_VISIT_CASE(n) CBI_VISIT_CASE(n + 1) CBI_VISIT_CASE(n + 2) CBI_VISIT_CASE(n + 3) \
+            CBI_VISIT_CASE(n + 4) CBI_VISIT_CASE(n + 5) CBI_VISIT_CASE(n + 6) CBI_VISIT_CASE(n + 7)
+            CBI_VISIT_CASES8(0) CBI_VISIT_CASES8(8) CBI_VISIT_CASES8(16) CBI_VISIT_CASES8(24)
+            CBI_VISIT_CASES8(32) CBI_VISIT_CASES8(40) CBI_VISIT_CASES8(48) CBI_VISIT_CASES8(56)
+#undef CBI_VISIT_CASES8
+#undef CBI_VISIT_CASE
+            default:
+                break;
+            }
+#if defined(__GNUC__)
+            __builtin_unreachable();
+#else
+            throw std::bad_variant_access();
+#endif
+        } else {
+            static constexpr auto table = make_table(std::make_index_sequence<count>{});
+            return table[flat](std::forward<Fn>(fn), std::forward<Vs>(vs)...);
+        }
+    }
+};
+
+} // namespace detail
+
+/// Call fn with the alternatives held by each of the variants, as
+/// std::visit does.  Up to 64 combinations of alternatives, (the product of
+/// the variants' sizes), are handled by a single switch, and more by a
+/// single table of functions, so the cost doesn't depend on the standard
+/// library.  fn must return the same type for every combination.
+/// @param fn The function to call.
+/// @param vs The std::variants, (of any value category).
+/// @return what fn returns.
+/// @throw std::bad_variant_access if any of the variants is valueless.
+/// @par Example
+/// @code
+///     std::variant<int, std::string> v = "text";
+///     CompuBrite::visit(overloaded{[](int i) { ... },
+///                                  [](const std::string &s) { ... }}, v);
+/// @endcode
+template<typename Fn, typename... Vs>
+decltype(auto) visit(Fn &&fn, Vs &&...vs)
+{
+    static_assert(sizeof...(Vs) > 0, "visit() needs at least one variant");
+    using R = std::invoke_result_t<Fn&&, decltype(std::get<0>(std::declval<Vs>()))...>;
+    return detail::Visitor<R, Fn, std::index_sequence_for<Vs...>, Vs...>::visit(
+        std::forward<Fn>(fn), std::forward<Vs>(vs)...);
+}
+
+} // namespace CompuBrite
+#endif // COMPUBRITE_VISIT_H_INCLUDED
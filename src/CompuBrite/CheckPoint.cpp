@@ -22,36 +22,869 @@
 */
 
 #include "CompuBrite/CheckPoint.h"
+#include "CompuBrite/flat_map.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <streambuf>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace CompuBrite {
 
+namespace {
+
+/// The start of a trace file, (see CheckPoint::binary_output()).
+constexpr char TraceMagic[8] = {'C', 'B', 'I', 'T', 'R', 'A', 'C', 'E'};
+
+/// Turns binary trace records back into text, (as CheckPoint::out() would
+/// have written them, with the thread and time added).  A trace is a series
+/// of records, each a letter followed by its fields:
+///   - 'S' defines a source location: number, line, file and function.
+///   - 'C' defines a category: number and name.
+///   - 'E' is a message: location, category, thread, time and values.
+///   - 'D' counts the messages a thread dropped: thread and count.
+/// Strings are a 32 bit size followed by the characters.
+class TraceDecoder
+{
+public:
+    /// Decode the records in [data, data + size).
+    /// @return false if the records are malformed or truncated.
+    bool decode(const char *data, size_t size, std::ostream &os)
+    {
+        p_ = data;
+        end_ = data + size;
+        while (p_ < end_) {
+            auto kind = *p_++;
+            if (!record(kind, os)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Site
+    {
+        std::string     file;
+        std::string     func;
+        std::uint32_t   line;
+    };
+
+    bool record(char kind, std::ostream &os)
+    {
+        std::uint32_t id, line, category, thread, size;
+        std::uint64_t time, count;
+        std::string_view file, func, name;
+        switch (kind) {
+        case 'S':
+            if (!get(id) || !get(line) || !get(file) || !get(func)) {
+                return false;
+            }
+            sites_[id] = Site{std::string(file), std::string(func), line};
+            return true;
+        case 'C':
+            if (!get(id) || !get(name)) {
+                return false;
+            }
+            categories_[id] = std::string(name);
+            return true;
+        case 'D':
+            if (!get(thread) || !get(count)) {
+                return false;
+            }
+            os << "@@@ CheckPoint: " << count << " messages dropped by thread "
+               << thread << '\n';
+            return true;
+        case 'E':
+            if (!get(id) || !get(category) || !get(thread) || !get(time) ||
+                !get(size) || static_cast<size_t>(end_ - p_) < size) {
+                return false;
+            }
+            {
+                // A message for a site or category never defined, (say, in a
+                // trace missing its start), is malformed.
+                auto site = sites_.find(id);
+                auto cat = categories_.find(category);
+                if (site == sites_.end() || cat == categories_.end()) {
+                    return false;
+                }
+                char when[32];
+                std::snprintf(when, sizeof(when), "%llu.%09llu",
+                              static_cast<unsigned long long>(time / 1000000000),
+                              static_cast<unsigned long long>(time % 1000000000));
+                os << "@@@ CheckPoint (" << cat->second << "): "
+                   << site->second.file << ':' << site->second.line << " ("
+                   << site->second.func
+                   << ") [thread " << thread << " at " << when << "]\n@@@ ";
+                auto end = end_;
+                end_ = p_ + size;
+                auto ok = values(os);
+                end_ = end;
+                os << '\n';
+                return ok;
+            }
+        default:
+            return false;
+        }
+    }
+
+    /// Print the values of a message, [p_, end_).
+    bool values(std::ostream &os)
+    {
+        while (p_ < end_) {
+            auto tag = static_cast<detail::TraceTag>(*p_++);
+            bool ok;
+            switch (tag) {
+            case detail::TraceTag::Bool:        ok = printBool(os); break;
+            case detail::TraceTag::Char:        ok = print<char>(os); break;
+            case detail::TraceTag::SChar:       ok = print<signed char>(os); break;
+            case detail::TraceTag::UChar:       ok = print<unsigned char>(os); break;
+            case detail::TraceTag::Short:       ok = print<short>(os); break;
+            case detail::TraceTag::UShort:      ok = print<unsigned short>(os); break;
+            case detail::TraceTag::Int:         ok = print<int>(os); break;
+            case detail::TraceTag::UInt:        ok = print<unsigned>(os); break;
+            case detail::TraceTag::Long:        ok = print<long>(os); break;
+            case detail::TraceTag::ULong:       ok = print<unsigned long>(os); break;
+            case detail::TraceTag::LongLong:    ok = print<long long>(os); break;
+            case detail::TraceTag::ULongLong:   ok = print<unsigned long long>(os); break;
+            case detail::TraceTag::Float:       ok = print<float>(os); break;
+            case detail::TraceTag::Double:      ok = print<double>(os); break;
+            case detail::TraceTag::LongDouble:  ok = print<long double>(os); break;
+            case detail::TraceTag::Pointer:     ok = print<const void*>(os); break;
+            case detail::TraceTag::String:      ok = print<std::string_view>(os); break;
+            default:                            ok = false; break;
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// A bool is written as one byte, which must be 0 or 1, (any other
+    /// value isn't a bool, so it isn't copied into one).
+    bool printBool(std::ostream &os)
+    {
+        std::uint8_t value;
+        if (!get(value) || value > 1) {
+            return false;
+        }
+        os << (value != 0);
+        return true;
+    }
+
+    template <typename T>
+    bool print(std::ostream &os)
+    {
+        T value;
+        if (!get(value)) {
+            return false;
+        }
+        os << value;
+        return true;
+    }
+
+    template <typename T>
+    bool get(T &value)
+    {
+        if (static_cast<size_t>(end_ - p_) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, p_, sizeof(T));
+        p_ += sizeof(T);
+        return true;
+    }
+
+    bool get(std::string_view &text)
+    {
+        std::uint32_t size;
+        if (!get(size) || static_cast<size_t>(end_ - p_) < size) {
+            return false;
+        }
+        text = std::string_view(p_, size);
+        p_ += size;
+        return true;
+    }
+
+    const char                                      *p_{nullptr};
+    const char                                      *end_{nullptr};
+    flat_map<std::uint32_t, Site>                   sites_;
+    flat_map<std::uint32_t, std::string>            categories_;
+};
+
+} // namespace
+
+bool
+CheckPoint::decode(std::istream &in, std::ostream &out)
+{
+    std::string trace((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+    if (trace.compare(0, sizeof(TraceMagic),
+                      std::string_view(TraceMagic, sizeof(TraceMagic))) != 0) {
+        return false;
+    }
+    TraceDecoder decoder;
+    return decoder.decode(trace.data() + sizeof(TraceMagic),
+                          trace.size() - sizeof(TraceMagic), out);
+}
+
 #ifdef CBI_CHECKPOINTS
-bool CheckPoint::init_{false};
-bool CheckPoint::all_{false};
-bool CheckPoint::disabled_{false};
-std::unordered_set<std::string> CheckPoint::categories_;
-std::function<void()> CheckPoint::trap_ = [] {};
-
-CheckPoint::CheckPoint(std::string &&category, std::ostream& out) :
-    category_(std::move(category)),
+namespace {
+
+/// Append a value to a trace.
+template <typename T>
+void
+put(std::string &to, const T &value)
+{
+    to.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void
+put(std::string &to, std::string_view text)
+{
+    put(to, static_cast<std::uint32_t>(text.size()));
+    to.append(text.data(), text.size());
+}
+
+/// A streambuf which appends to a string, so that the buffer for a message
+/// may be reused without reallocating.
+class RecordBuf : public std::streambuf
+{
+public:
+    std::string text;
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            text.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        text.append(s, static_cast<size_t>(n));
+        return n;
+    }
+};
+
+/// The buffer, and a stream to format into it, for one thread's messages.
+struct Recorder
+{
+    RecordBuf       buf;
+    std::ostream    stream{&buf};
+};
+
+Recorder&
+recorder()
+{
+    thread_local Recorder r;
+    return r;
+}
+
+/// Write all of data to fd.
+void
+writeAll(int fd, const char *data, size_t size)
+{
+    while (size) {
+        auto n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+
+/// Writes messages to stderr on a background thread.  Messages are pushed
+/// onto a lock free stack; the writer takes the whole stack at once, and
+/// reverses it to restore their order, then writes them in one go.
+class AsyncWriter
+{
+public:
+    /// @return the AsyncWriter.  It is never destroyed, (so messages may
+    /// still be queued at exit), and its thread is started by the first
+    /// call to start().
+    static AsyncWriter& instance()
+    {
+        static auto writer = new AsyncWriter;
+        return *writer;
+    }
+
+    void start()
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (!running_) {
+            running_ = true;
+            std::thread([this]() { run(); }).detach();
+            std::atexit([]() { instance().flush(); });
+        }
+    }
+
+    /// Queue a message.  The thread must have been started.
+    void push(const std::string &text)
+    {
+        auto node = static_cast<Node*>(
+            ::operator new(offsetof(Node, text) + text.size()));
+        node->size = text.size();
+        text.copy(node->text, text.size());
+        // Count the node before linking it, so the writer can never have
+        // written more than pushed_, and flush() always waits for it.
+        pushed_.fetch_add(1);
+        node->next = head_.load(std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(node->next, node)) {
+        }
+        if (waiting_.load()) {
+            std::lock_guard<std::mutex> l(mutex_);
+            wake_.notify_one();
+        }
+    }
+
+    /// Wait until the messages pushed so far have been written.
+    void flush()
+    {
+        auto target = pushed_.load();
+        std::unique_lock<std::mutex> l(mutex_);
+        written_.wait(l, [this, target]() { return !running_ || done_ >= target; });
+    }
+
+private:
+    struct Node
+    {
+        Node   *next;
+        size_t  size;
+        char    text[1];
+    };
+
+    void run()
+    {
+        std::string batch;
+        while (true) {
+            auto list = head_.exchange(nullptr, std::memory_order_acquire);
+            if (!list) {
+                std::unique_lock<std::mutex> l(mutex_);
+                waiting_.store(true);
+                if (!head_.load()) {
+                    wake_.wait(l);
+                }
+                waiting_.store(false);
+                continue;
+            }
+
+            Node *first = nullptr;
+            while (list) {
+                auto next = list->next;
+                list->next = first;
+                first = list;
+                list = next;
+            }
+            size_t n = 0;
+            batch.clear();
+            while (first) {
+                batch.append(first->text, first->size);
+                auto next = first->next;
+                ::operator delete(first);
+                first = next;
+                ++n;
+            }
+            writeAll(STDERR_FILENO, batch.data(), batch.size());
+
+            std::lock_guard<std::mutex> l(mutex_);
+            done_ += n;
+            written_.notify_all();
+        }
+    }
+
+    std::atomic<Node*>          head_{nullptr};
+    std::atomic<size_t>         pushed_{0};
+    std::atomic<bool>           waiting_{false};
+    std::mutex                  mutex_;
+    std::condition_variable     wake_;
+    std::condition_variable     written_;
+    size_t                      done_{0};
+    bool                        running_{false};
+};
+
+std::atomic<bool> async_{false};
+std::mutex syncMutex_;
+
+} // namespace
+
+std::atomic<bool> CheckPoint::init_{false};
+std::atomic<bool> CheckPoint::all_{false};
+std::atomic<bool> CheckPoint::disabled_{false};
+std::atomic<bool> CheckPoint::binary_{false};
+std::atomic<std::uint64_t> CheckPoint::generation_{1};
+std::atomic<std::uint64_t> CheckPoint::categories_[MaxCategories / 64];
+
+namespace {
+
+/// What an exception CheckPoint does after printing its message.
+enum class Trap
+{
+    Continue,
+    Fatal,
+    Crash
+};
+
+std::atomic<Trap> trap_{Trap::Continue};
+
+/// Held while the configuration is changed.
+std::mutex config_;
+
+/// Set by the reload signal handler, (see CheckPoint::reload_on_signal()).
+std::atomic<bool> reloadPending_{false};
+
+/// Where the reload signal handler reads the configuration from, (if not
+/// from the environment).
+std::string reloadPath_;
+
+/// Every Site which has been reached, (most recent first).  Sites are only
+/// added, (under config_), and never removed.
+std::atomic<CheckPoint::Site*> sites_{nullptr};
+
+/// The names of the categories, (kept apart from the global pool, so that
+/// their indices are small).
+string_pool&
+categoryNames()
+{
+    static auto pool = new string_pool(1);
+    return *pool;
+}
+
+/// One thread's binary trace records.  The thread adds records at head_,
+/// and the TraceWriter takes them from tail_, so neither waits for the
+/// other.  A record which doesn't fit is dropped, (and counted).  A record
+/// never wraps around the end of the buffer; if it doesn't fit before the
+/// end, a record of size 0 marks the rest of the buffer as unused.
+class TraceRing
+{
+public:
+    static constexpr size_t Capacity = 256 * 1024;
+
+    /// The start of each record, followed by the values.
+    struct Header
+    {
+        std::uint32_t   size;           ///< Of the record, (a multiple of 8).
+        std::uint32_t   values;         ///< The size of the values.
+        std::uint64_t   time;           ///< steady_clock, in nanoseconds.
+        const char     *file;
+        const char     *func;
+        const char     *category;       ///< The category's name.
+        std::uint32_t   line;
+        std::uint32_t   length;         ///< Of the category's name.
+    };
+
+    explicit TraceRing(std::uint32_t thread) : thread_(thread) { }
+
+    /// Reserve size bytes, (a multiple of 8), for a record.  Only the
+    /// owning thread may call this.
+    /// @return the record, or nullptr if there isn't room.
+    char *begin(size_t size)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto tail = tail_.load(std::memory_order_acquire);
+        auto offset = head % Capacity;
+        auto skip = Capacity - offset < size ? Capacity - offset : 0;
+        if (head + skip + size - tail > Capacity) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        if (skip) {
+            std::uint32_t none = 0;
+            std::memcpy(data_ + offset, &none, sizeof(none));
+            head += skip;
+        }
+        next_ = head + size;
+        return data_ + head % Capacity;
+    }
+
+    /// Publish the record reserved by begin().
+    void commit()                       { head_.store(next_, std::memory_order_release); }
+
+    /// Call fn(header, values) for every record published so far, then
+    /// release them.  Only the TraceWriter may call this.
+    template <typename Fn>
+    void drain(Fn &&fn)
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto head = head_.load(std::memory_order_acquire);
+        while (tail < head) {
+            auto p = data_ + tail % Capacity;
+            std::uint32_t size;
+            std::memcpy(&size, p, sizeof(size));
+            if (size == 0) {
+                tail += Capacity - tail % Capacity;
+                continue;
+            }
+            Header header;
+            std::memcpy(&header, p, sizeof(header));
+            fn(header, p + sizeof(header));
+            tail += size;
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+
+    /// @return the number of records dropped since this was last called.
+    std::uint64_t dropped()             { return dropped_.exchange(0); }
+
+    std::uint32_t thread() const        { return thread_; }
+
+    /// Mark the ring as finished with, (its thread has exited).
+    void close()                        { closed_.store(true, std::memory_order_release); }
+
+    bool closed() const                 { return closed_.load(std::memory_order_acquire); }
+
+private:
+    alignas(64) std::atomic<std::uint64_t>  head_{0};
+    std::uint64_t                           next_{0};
+    alignas(64) std::atomic<std::uint64_t>  tail_{0};
+    std::atomic<std::uint64_t>              dropped_{0};
+    std::atomic<bool>                       closed_{false};
+    const std::uint32_t                     thread_;
+    alignas(8) char                         data_[Capacity];
+};
+
+/// Takes the records from every thread's TraceRing on a background thread,
+/// (every millisecond while binary output is on, or when flushed, and the
+/// thread sleeps until it is turned on again), sorts them by time, and writes
+/// them to the trace file, or decodes them to stderr.  The file holds a
+/// definition of each source location and category the first time it is
+/// used, so each message only refers to them by number.
+class TraceWriter
+{
+public:
+    /// @return the TraceWriter.  It is never destroyed, (as for AsyncWriter).
+    static TraceWriter& instance()
+    {
+        static auto writer = new TraceWriter;
+        return *writer;
+    }
+
+    /// Start writing records, to the file at path, or to stderr, as text, if
+    /// path is empty.  Changing the path starts a new file.
+    void start(const std::string &path)
+    {
+        std::lock_guard<std::mutex> l(drain_);
+        if (!running_) {
+            running_ = true;
+            std::thread([this]() { run(); }).detach();
+            std::atexit([]() { instance().flush(); });
+        }
+        if (!active_) {
+            active_ = true;
+            wake_.notify_one();
+        } else if (path == path_) {
+            return;
+        }
+        drain();
+        close();
+        path_ = path;
+        if (!path.empty()) {
+            fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd_ < 0) {
+                std::cerr << "@@@ CheckPoint: can't write trace file " << path << std::endl;
+            } else {
+                writeAll(fd_, TraceMagic, sizeof(TraceMagic));
+            }
+        }
+    }
+
+    /// Write out the records so far, then stop writing to the trace file,
+    /// and park the background thread until start() is called again.
+    void stop()
+    {
+        std::lock_guard<std::mutex> l(drain_);
+        active_ = false;
+        wake_.notify_one();
+        drain();
+        close();
+        path_.clear();
+    }
+
+    /// Write out the records published so far.
+    void flush()
+    {
+        std::lock_guard<std::mutex> l(drain_);
+        drain();
+    }
+
+    /// @return the calling thread's TraceRing.
+    TraceRing& ring()
+    {
+        thread_local struct Holder
+        {
+            TraceRing *ring{nullptr};
+            ~Holder()
+            {
+                if (ring) {
+                    ring->close();
+                }
+            }
+        } holder;
+        if (!holder.ring) {
+            auto ring = std::make_unique<TraceRing>(
+                static_cast<std::uint32_t>(::syscall(SYS_gettid)));
+            holder.ring = ring.get();
+            std::lock_guard<std::mutex> l(mutex_);
+            rings_.push_back(std::move(ring));
+        }
+        return *holder.ring;
+    }
+
+private:
+    /// A message taken from a TraceRing, (at events_[offset]).
+    struct Event
+    {
+        std::uint64_t   time;
+        size_t          offset;
+        size_t          size;
+    };
+
+    void run()
+    {
+        std::unique_lock<std::mutex> l(drain_);
+        while (true) {
+            wake_.wait(l, [this]() { return active_; });
+            if (!wake_.wait_for(l, std::chrono::milliseconds(1),
+                                [this]() { return !active_; })) {
+                drain();
+            }
+        }
+    }
+
+    /// Forget the file, (and what has been defined in it).
+    void close()
+    {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        sites_.clear();
+        categories_.clear();
+        decoder_ = TraceDecoder();
+    }
+
+    /// Take the records from every TraceRing, and write them out.  drain_
+    /// must be held.
+    void drain()
+    {
+        batch_.clear();
+        events_.clear();
+        order_.clear();
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            for (auto i = rings_.begin(); i != rings_.end(); ) {
+                auto &ring = **i;
+                auto closed = ring.closed();
+                if (auto dropped = ring.dropped()) {
+                    batch_ += 'D';
+                    put(batch_, ring.thread());
+                    put(batch_, dropped);
+                }
+                ring.drain([this, &ring](const TraceRing::Header &header,
+                                         const char *values)
+                    {
+                        auto site = define(header);
+                        order_.push_back({header.time, events_.size(), 0});
+                        events_ += 'E';
+                        put(events_, site);
+                        put(events_, category(header));
+                        put(events_, ring.thread());
+                        put(events_, header.time);
+                        put(events_, header.values);
+                        events_.append(values, header.values);
+                        order_.back().size = events_.size() - order_.back().offset;
+                    });
+                i = closed ? rings_.erase(i) : i + 1;
+            }
+        }
+        if (order_.empty() && batch_.empty()) {
+            return;
+        }
+        std::stable_sort(order_.begin(), order_.end(),
+            [](const Event &a, const Event &b) { return a.time < b.time; });
+        for (auto &e : order_) {
+            batch_.append(events_, e.offset, e.size);
+        }
+
+        if (fd_ >= 0) {
+            writeAll(fd_, batch_.data(), batch_.size());
+            return;
+        }
+        text_.str(std::string());
+        decoder_.decode(batch_.data(), batch_.size(), text_);
+        auto text = text_.str();
+        writeAll(STDERR_FILENO, text.data(), text.size());
+    }
+
+    /// Define the record's source location if it hasn't been already.
+    /// @return the number of the source location.
+    std::uint32_t define(const TraceRing::Header &header)
+    {
+        auto key = std::make_tuple(header.file, header.func, header.line);
+        auto found = sites_.find(key);
+        if (found == sites_.end()) {
+            found = sites_.emplace(key, static_cast<std::uint32_t>(sites_.size())).first;
+            batch_ += 'S';
+            put(batch_, found->second);
+            put(batch_, header.line);
+            put(batch_, std::string_view(header.file));
+            put(batch_, std::string_view(header.func));
+        }
+        return found->second;
+    }
+
+    /// Define the record's category if it hasn't been already.
+    /// @return the number of the category.
+    std::uint32_t category(const TraceRing::Header &header)
+    {
+        auto found = categories_.find(header.category);
+        if (found == categories_.end()) {
+            found = categories_.emplace(header.category,
+                static_cast<std::uint32_t>(categories_.size())).first;
+            batch_ += 'C';
+            put(batch_, found->second);
+            put(batch_, std::string_view(header.category, header.length));
+        }
+        return found->second;
+    }
+
+    std::mutex                                      mutex_;     ///< For rings_.
+    std::vector<std::unique_ptr<TraceRing>>         rings_;
+    std::mutex                                      drain_;     ///< For the rest.
+    flat_map<std::tuple<const char*, const char*, std::uint32_t>,
+             std::uint32_t>                         sites_;
+    flat_map<const char*, std::uint32_t>            categories_;
+    std::string                                     batch_;
+    std::string                                     events_;
+    std::vector<Event>                              order_;
+    std::ostringstream                              text_;
+    TraceDecoder                                    decoder_;
+    std::string                                     path_;
+    int                                             fd_{-1};
+    std::condition_variable                         wake_;      ///< For active_.
+    bool                                            running_{false};
+    bool                                            active_{false};
+};
+
+} // namespace
+
+CheckPoint::Category::Category(const char *name) :
+    record_(categoryNames().from_string(name))
+{ }
+
+CheckPoint::CheckPoint(Category category, std::ostream& out) :
+    category_(category),
     out_(out)
 
 {
-    if (!init_) {
+    if (!init_.load(std::memory_order_acquire)) {
         init();
     }
-    active_ = active(category_);
+    auto generation = generation_.load(std::memory_order_acquire);
+    state_.store((generation << 1) | (enabled(category_.id()) ? 1 : 0),
+                 std::memory_order_relaxed);
 }
 
 bool
-CheckPoint::active(const std::string &category)
+CheckPoint::enabled(size_t id)
 {
-    if (!init_) {
-        init();
+    pending();
+    return lookup(id);
+}
+
+void
+CheckPoint::pending()
+{
+    if (reloadPending_.load(std::memory_order_relaxed) &&
+        reloadPending_.exchange(false)) {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> l(config_);
+            path = reloadPath_;
+        }
+        if (path.empty()) {
+            reload();
+        } else {
+            std::ifstream in(path);
+            std::ostringstream spec;
+            spec << in.rdbuf();
+            reload(spec.str().c_str());
+        }
+    }
+}
+
+bool
+CheckPoint::lookup(size_t id)
+{
+    if (all_.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    if (id >= MaxCategories) {
+        return false;
+    }
+    auto bits = categories_[id / 64].load(std::memory_order_relaxed);
+    return (bits >> (id % 64)) & 1;
+}
+
+void
+CheckPoint::refresh()
+{
+    for (auto site = sites_.load(std::memory_order_acquire); site; site = site->next_) {
+        site->state_.store(site->wanted() ? Site::On : Site::Off,
+                           std::memory_order_release);
+    }
+}
+
+bool
+CheckPoint::Site::wanted() const
+{
+    return category_ ? lookup(id_) : !disabled_.load(std::memory_order_relaxed);
+}
+
+bool
+CheckPoint::Site::check()
+{
+    init();
+    pending();
+    auto id = category_ ? Category(category_).id() : 0;
+    std::lock_guard<std::mutex> l(config_);
+    if (!linked_) {
+        id_ = id;
+        linked_ = true;
+        next_ = sites_.load(std::memory_order_relaxed);
+        sites_.store(this, std::memory_order_release);
     }
-    return all_ || categories_.find(category) != categories_.end();
+    auto on = wanted();
+    // Released, so a thread which sees the flag also sees id_.
+    state_.store(on ? On : Off, std::memory_order_release);
+    return on;
 }
 
 void
@@ -60,7 +893,14 @@ CheckPoint::enable(const char *category)
     if (!category) {
         return;
     }
-    categories_.insert(category);
+    init();
+    auto id = Category(category).id();
+    std::lock_guard<std::mutex> l(config_);
+    if (id < MaxCategories) {
+        categories_[id / 64].fetch_or(std::uint64_t{1} << (id % 64));
+        generation_.fetch_add(1, std::memory_order_acq_rel);
+        refresh();
+    }
 }
 
 void
@@ -69,60 +909,452 @@ CheckPoint::disable(const char *category)
     if (!category) {
         return;
     }
-    auto found = categories_.find(category);
-    if (found == categories_.end()) {
-        return;
+    init();
+    auto id = Category(category).id();
+    std::lock_guard<std::mutex> l(config_);
+    if (id < MaxCategories) {
+        categories_[id / 64].fetch_and(~(std::uint64_t{1} << (id % 64)));
+        generation_.fetch_add(1, std::memory_order_acq_rel);
+        refresh();
     }
-    categories_.erase(found);
 }
 
 void
 CheckPoint::init()
 {
-    if (init_) {
-        return;
+    static std::once_flag once;
+    std::call_once(once, []()
+        {
+            auto c = getenv("CBI_CHECKPOINTS");
+            apply(c ? c : "");
+            init_.store(true, std::memory_order_release);
+        });
+}
+
+void
+CheckPoint::reload(const char *spec)
+{
+    init();
+    if (!spec) {
+        spec = getenv("CBI_CHECKPOINTS");
     }
-    init_ = true;
-    auto c = getenv("CBI_CHECKPOINTS");
-    if (!c) {
-        return;
+    apply(spec ? spec : "");
+}
+
+void
+CheckPoint::reload_on_signal(int signal, const std::string &path)
+{
+    init();
+    {
+        std::lock_guard<std::mutex> l(config_);
+        reloadPath_ = path;
     }
-    std::string ckpts{c};
+    // Only lock free atomics are touched in the handler.  Bumping the
+    // generation makes every CheckPoint look at its category again, (and
+    // every Site, once its flag is Unknown), which does the reload.
+    struct sigaction action{};
+    action.sa_handler = [](int)
+        {
+            reloadPending_.store(true);
+            generation_.fetch_add(1);
+            for (auto site = sites_.load(std::memory_order_acquire); site;
+                 site = site->next_) {
+                site->state_.store(Site::Unknown, std::memory_order_relaxed);
+            }
+        };
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(signal, &action, nullptr);
+}
 
-    if (ckpts.empty()) {
-        return;
+void
+CheckPoint::apply(const std::string &spec)
+{
+    // Build the new set of categories before publishing any of it.
+    std::uint64_t bits[MaxCategories / 64] = {};
+    auto all = false;
+    auto disabled = false;
+    auto async = false;
+    auto binary = false;
+    auto trap = Trap::Continue;
+
+    size_t begin = 0;
+    while (begin <= spec.size()) {
+        auto end = spec.find_first_of(": \t\r\n", begin);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        auto cat = spec.substr(begin, end - begin);
+        begin = end + 1;
+        if (cat.empty()) {
+            continue;
+        }
+        if (cat == "*" || cat == "all") {
+            all = true;
+        } else if (cat == "expect-off") {
+            disabled = true;
+        } else if (cat == "async") {
+            async = true;
+        } else if (cat == "binary") {
+            binary = true;
+        } else if (cat == "expect-crash") {
+            trap = Trap::Crash;
+        } else if (cat == "expect-fatal") {
+            trap = Trap::Fatal;
+        } else {
+            auto id = Category(cat).id();
+            if (id < MaxCategories) {
+                bits[id / 64] |= std::uint64_t{1} << (id % 64);
+            }
+        }
     }
-    auto begin = ckpts.begin();
-    auto end   = begin;
-    do {
-        ++end;
-        if (end == ckpts.end() || *end == ':') {
-            std::string cat{begin, end};
-            if (cat == "*" || cat == "all") {
-                all_ = true;
-            } else if (cat == "expect-off") {
-                disabled_ = true;
-            } else if (cat == "expect-crash") {
-                trap_ = [] { char *p = nullptr; auto c = *p; };
-            } else if (cat == "expect-fatal") {
-                trap_ = []
-                    {
-                        std::cerr << "Aborting" << std::endl;
-                        abort();
-                    };
-            } else {
-                categories_.emplace(std::move(cat));
+
+    std::lock_guard<std::mutex> l(config_);
+    for (auto i = 0u; i < MaxCategories / 64; ++i) {
+        categories_[i].store(bits[i], std::memory_order_relaxed);
+    }
+    all_.store(all, std::memory_order_relaxed);
+    disabled_.store(disabled, std::memory_order_relaxed);
+    trap_.store(trap, std::memory_order_relaxed);
+    async_output(async);
+    auto path = getenv("CBI_CHECKPOINTS_TRACE");
+    binary_output(binary, path ? path : "");
+    generation_.fetch_add(1, std::memory_order_acq_rel);
+    refresh();
+}
+
+void
+CheckPoint::async_output(bool on)
+{
+    if (on) {
+        AsyncWriter::instance().start();
+        async_.store(true);
+    } else if (async_.exchange(false)) {
+        AsyncWriter::instance().flush();
+    }
+}
+
+void
+CheckPoint::flush()
+{
+    if (async_.load()) {
+        AsyncWriter::instance().flush();
+    }
+    if (binary_.load()) {
+        TraceWriter::instance().flush();
+    }
+}
+
+void
+CheckPoint::binary_output(bool on, const std::string &path)
+{
+    if (on) {
+        TraceWriter::instance().start(path);
+        binary_.store(true);
+    } else if (binary_.exchange(false)) {
+        TraceWriter::instance().stop();
+    }
+}
+
+char *
+CheckPoint::traceBegin(const Here &here, std::string_view category, size_t size)
+{
+    using Header = TraceRing::Header;
+    auto total = (sizeof(Header) + size + 7) & ~size_t{7};
+    auto p = TraceWriter::instance().ring().begin(total);
+    if (!p) {
+        return nullptr;
+    }
+    auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    Header header{static_cast<std::uint32_t>(total),
+                  static_cast<std::uint32_t>(size),
+                  static_cast<std::uint64_t>(time),
+                  here.file(), here.function(), category.data(),
+                  static_cast<std::uint32_t>(here.line()),
+                  static_cast<std::uint32_t>(category.size())};
+    std::memcpy(p, &header, sizeof(header));
+    return p + sizeof(header);
+}
+
+void
+CheckPoint::traceCommit()
+{
+    TraceWriter::instance().ring().commit();
+}
+
+namespace {
+
+/// A histogram of durations, in nanoseconds, with buckets which are
+/// linear up to 16ns, and then 8 to each power of two, (so each bucket is
+/// within 12.5% of the values in it), as for an HDR histogram.
+struct Timings
+{
+    static constexpr size_t Linear = 16;
+    static constexpr size_t PerPower = 8;
+    static constexpr size_t Buckets = Linear + (64 - 4) * PerPower;
+
+    static size_t bucket(std::uint64_t ns)
+    {
+        if (ns < Linear) {
+            return static_cast<size_t>(ns);
+        }
+        auto power = 63 - static_cast<size_t>(__builtin_clzll(ns));
+        auto sub = static_cast<size_t>(ns >> (power - 3)) & (PerPower - 1);
+        return Linear + (power - 4) * PerPower + sub;
+    }
+
+    /// @return the middle of a bucket.
+    static std::uint64_t value(size_t bucket)
+    {
+        if (bucket < Linear) {
+            return bucket;
+        }
+        auto power = (bucket - Linear) / PerPower + 4;
+        auto sub = (bucket - Linear) % PerPower;
+        auto low = (PerPower + sub) << (power - 3);
+        return low + (std::uint64_t{1} << (power - 3)) / 2;
+    }
+
+    /// @return the value below which p percent of the durations fall.
+    std::uint64_t percentile(double p) const
+    {
+        auto want = static_cast<std::uint64_t>(count * p / 100.0);
+        std::uint64_t n = 0;
+        for (auto i = 0u; i < Buckets; ++i) {
+            n += counts[i];
+            if (n > want) {
+                return std::min(value(i), max);
             }
-            if (end != ckpts.end()) {
-                begin = ++end;
+        }
+        return max;
+    }
+
+    Timings& operator+=(const Timings &rhs)
+    {
+        for (auto i = 0u; i < Buckets; ++i) {
+            counts[i] += rhs.counts[i];
+        }
+        count += rhs.count;
+        total += rhs.total;
+        max = std::max(max, rhs.max);
+        return *this;
+    }
+
+    std::uint64_t   counts[Buckets] = {};
+    std::uint64_t   count{0};
+    std::uint64_t   total{0};
+    std::uint64_t   max{0};
+};
+
+/// The durations recorded by one thread for one category.  Only that
+/// thread writes the counters, (with a load and a store, rather than a
+/// read-modify-write), while dump_timings() may read them at any time.
+class ThreadTimings
+{
+public:
+    explicit ThreadTimings(const char *name) : name_(name) { }
+
+    /// @return the name of the category.
+    const char *name() const            { return name_; }
+
+    void add(std::uint64_t ns)
+    {
+        bump(counts_[Timings::bucket(ns)], 1);
+        bump(count_, 1);
+        bump(total_, ns);
+        if (ns > max_.load(std::memory_order_relaxed)) {
+            max_.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    /// Add these counters to totals.
+    void addTo(Timings &totals) const
+    {
+        for (auto i = 0u; i < Timings::Buckets; ++i) {
+            totals.counts[i] += counts_[i].load(std::memory_order_relaxed);
+        }
+        totals.count += count_.load(std::memory_order_relaxed);
+        totals.total += total_.load(std::memory_order_relaxed);
+        totals.max = std::max(totals.max, max_.load(std::memory_order_relaxed));
+    }
+
+private:
+    static void bump(std::atomic<std::uint64_t> &counter, std::uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n,
+                      std::memory_order_relaxed);
+    }
+
+    const char                  *name_;
+    std::atomic<std::uint64_t>  counts_[Timings::Buckets] = {};
+    std::atomic<std::uint64_t>  count_{0};
+    std::atomic<std::uint64_t>  total_{0};
+    std::atomic<std::uint64_t>  max_{0};
+};
+
+/// Every thread's timings, (by category), and the totals of the threads
+/// which have exited.
+class TimingRegistry
+{
+public:
+    /// The timings of one thread.  Only the thread adds categories to it,
+    /// (under mutex, so that dump_timings() may look at them).
+    struct Thread
+    {
+        std::mutex                                          mutex;
+        flat_map<size_t, std::unique_ptr<ThreadTimings>>    categories;
+    };
+
+    /// @return the TimingRegistry.  It is never destroyed, (so that threads
+    /// may exit after main()).
+    static TimingRegistry& instance()
+    {
+        static auto registry = new TimingRegistry;
+        return *registry;
+    }
+
+    /// @return the calling thread's timings for the category.
+    /// @param category The category's id.
+    /// @param name The category's name, (which must outlive the registry).
+    ThreadTimings& timings(size_t category, const char *name)
+    {
+        thread_local struct Holder
+        {
+            Thread *thread{nullptr};
+            ~Holder()
+            {
+                if (thread) {
+                    instance().retire(thread);
+                }
             }
+        } holder;
+        if (!holder.thread) {
+            holder.thread = new Thread;
+            std::lock_guard<std::mutex> l(mutex_);
+            threads_.push_back(holder.thread);
+        }
+        auto &categories = holder.thread->categories;
+        auto found = categories.find(category);
+        if (found == categories.end()) {
+            std::lock_guard<std::mutex> l(holder.thread->mutex);
+            found = categories.emplace(category, std::make_unique<ThreadTimings>(name)).first;
+        }
+        return *found->second;
+    }
+
+    /// @return the totals for each category, (by name).
+    std::map<std::string, Timings> totals()
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto result = retired_;
+        for (auto thread : threads_) {
+            std::lock_guard<std::mutex> t(thread->mutex);
+            for (auto &c : thread->categories) {
+                c.second->addTo(result[c.second->name()]);
+            }
+        }
+        return result;
+    }
+
+private:
+    /// Add an exited thread's timings to the totals.
+    void retire(Thread *thread)
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        for (auto &c : thread->categories) {
+            c.second->addTo(retired_[c.second->name()]);
+        }
+        threads_.erase(std::find(threads_.begin(), threads_.end(), thread));
+        delete thread;
+    }
+
+    std::mutex                      mutex_;
+    std::vector<Thread*>            threads_;
+    std::map<std::string, Timings>  retired_;
+};
+
+} // namespace
+
+void
+CheckPoint::timing(const Site &site, std::chrono::steady_clock::duration elapsed)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    TimingRegistry::instance().timings(site.id_, site.category_).add(static_cast<std::uint64_t>(ns));
+}
+
+void
+CheckPoint::dump_timings(std::ostream &os)
+{
+    auto totals = TimingRegistry::instance().totals();
+    auto &rec = record();
+    rec << "@@@ CheckPoint timings, (ns):\n";
+    char line[160];
+    std::snprintf(line, sizeof(line), "@@@ %-20s %10s %10s %10s %10s %10s %10s %10s\n",
+                  "category", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    rec << line;
+    for (auto &t : totals) {
+        auto &h = t.second;
+        if (!h.count) {
+            continue;
         }
-    } while (end != ckpts.end());
+        std::snprintf(line, sizeof(line),
+                      "@@@ %-20s %10llu %10llu %10llu %10llu %10llu %10llu %10llu\n",
+                      t.first.c_str(),
+                      static_cast<unsigned long long>(h.count),
+                      static_cast<unsigned long long>(h.total / h.count),
+                      static_cast<unsigned long long>(h.percentile(50)),
+                      static_cast<unsigned long long>(h.percentile(90)),
+                      static_cast<unsigned long long>(h.percentile(99)),
+                      static_cast<unsigned long long>(h.percentile(99.9)),
+                      static_cast<unsigned long long>(h.max));
+        rec << line;
+    }
+    emit(os);
+}
+
+std::ostream&
+CheckPoint::record()
+{
+    auto &r = recorder();
+    r.buf.text.clear();
+    r.stream.clear();
+    r.stream.flags(std::ios_base::dec | std::ios_base::skipws);
+    r.stream.precision(6);
+    r.stream.fill(' ');
+    return r.stream;
+}
+
+void
+CheckPoint::emit(std::ostream &os)
+{
+    auto &text = recorder().buf.text;
+    if (&os == &std::cerr && async_.load(std::memory_order_relaxed)) {
+        AsyncWriter::instance().push(text);
+        return;
+    }
+    std::lock_guard<std::mutex> l(syncMutex_);
+    os.write(text.data(), static_cast<std::streamsize>(text.size()));
+    os.flush();
 }
 
 void CheckPoint::trap(const Here& here)
 {
-    trap_();
+    flush();
+    switch (trap_.load(std::memory_order_relaxed)) {
+    case Trap::Continue:
+        break;
+    case Trap::Fatal:
+        std::cerr << "Aborting" << std::endl;
+        abort();
+    case Trap::Crash:
+        {
+            volatile char *p = nullptr;
+            auto c = *p;
+            (void)c;
+        }
+        break;
+    }
 }
 
 std::ostream& operator<<(std::ostream& os, const Here &here)
@@ -25,13 +25,228 @@
 */
 
 #include "CompuBrite/ThreadPool.h"
+#include "CompuBrite/WorkStealingDeque.h"
 
 namespace CompuBrite
 {
 
+/// A Task on a worker's deque.  Nodes are recycled by the worker which
+/// allocated them, so that once the pool has warmed up, pushing a task onto
+/// a deque doesn't allocate.
+struct ThreadPool::Node
+{
+    Task      task;
+    Worker   *owner;
+    Node     *next{nullptr};
+#ifdef CBI_POOL_STATS
+    Clock::time_point queued;
+#endif
+};
+
+/// Count something in the statistics.  If CBI_POOL_STATS isn't defined,
+/// this expands to nothing, so its arguments aren't even evaluated.
+#ifdef CBI_POOL_STATS
+#define CBI_POOL_COUNT(...) __VA_ARGS__
+#else
+#define CBI_POOL_COUNT(...)
+#endif
+
+/// The statistics for a single thread.  Only that thread writes to them,
+/// so they are updated with plain loads and stores, and only read with
+/// atomics so that stats() may add them up at any time.  If CBI_POOL_STATS
+/// isn't defined, this is empty, and no thread has one of its own.
+struct ThreadPool::Counters
+{
+#ifdef CBI_POOL_STATS
+    using Counter = std::atomic<std::uint64_t>;
+    using Buckets = std::array<Counter, Stats::Histogram::Buckets>;
+
+    static void bump(Counter &c, std::uint64_t n = 1)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static void record(Buckets &buckets, Clock::duration d)
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        std::size_t i = 0;
+        while (ns > 1 && i < buckets.size() - 1) {
+            ns >>= 1;
+            ++i;
+        }
+        bump(buckets[i]);
+    }
+
+    static void read(const Buckets &buckets, Stats::Histogram &h)
+    {
+        for (auto i = 0u; i < buckets.size(); ++i) {
+            h.counts[i] = buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void woke(bool found)
+    {
+        bump(wakeups);
+        if (!found) {
+            bump(spurious);
+        }
+    }
+
+    void stole()                        { bump(steals); }
+
+    void ran(Clock::time_point queued, Clock::time_point start,
+             Clock::time_point end)
+    {
+        bump(tasks);
+        bump(busy, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       end - start).count());
+        record(queueLatency, start - queued);
+        record(runTime, end - start);
+    }
+
+    Counter tasks{0};
+    Counter steals{0};
+    Counter wakeups{0};
+    Counter spurious{0};
+    Counter busy{0};
+    Buckets queueLatency{};
+    Buckets runTime{};
+#endif
+};
+
+/// The per-thread state of a work-stealing pool.
+struct ThreadPool::Worker
+{
+    explicit Worker(ThreadPool &p, std::size_t i) : pool(p), seed(i + 1) { }
+
+    ~Worker()
+    {
+        while (auto node = deque.pop()) {
+            delete *node;
+        }
+        destroy(free);
+        destroy(returned.load());
+    }
+
+    /// @return a Node holding the given task, recycled if possible.
+    Node* allocate(Task &&task)
+    {
+        if (!free) {
+            free = returned.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (!free) {
+            return new Node{std::move(task), this};
+        }
+        auto node = free;
+        free = node->next;
+        node->task = std::move(task);
+        return node;
+    }
+
+    /// Give a finished Node back to the Worker which allocated it.  This
+    /// may be called from any of the pool's threads.
+    void release(Node *node)
+    {
+        node->task.reset();
+        if (node->owner == this) {
+            node->next = free;
+            free = node;
+            return;
+        }
+        node->owner->giveBack(node);
+    }
+
+    /// Push a finished Node onto this Worker's returned list.  This may be
+    /// called from any thread.
+    void giveBack(Node *node)
+    {
+        node->next = returned.load(std::memory_order_relaxed);
+        while (!returned.compare_exchange_weak(node->next, node,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed))
+            ;
+    }
+
+    /// @return a pseudo-random number, (xorshift), used to pick victims.
+    std::size_t random()
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return seed;
+    }
+
+    static void destroy(Node *list)
+    {
+        while (list) {
+            delete std::exchange(list, list->next);
+        }
+    }
+
+    ThreadPool                  &pool;
+    WorkStealingDeque<Node*>     deque;
+    std::uint64_t                seed;
+
+    /// Nodes available for reuse by this Worker's thread only.
+    Node                        *free{nullptr};
+
+    /// Nodes which other threads have finished with, waiting to be moved
+    /// to the free list.
+    std::atomic<Node*>           returned{nullptr};
+};
+
+thread_local ThreadPool::Worker *ThreadPool::_local = nullptr;
+
+namespace {
+
+/// Tell the CPU that this is a spin loop, so that it can save power and
+/// give way to a sibling hyperthread.
+inline void
+cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+/// Poll ready() according to the IdlePolicy: first with a pause between
+/// polls, then yielding the CPU between polls.
+/// @return true if ready() returned true.
+template <typename Ready>
+bool
+spinUntil(const ThreadPool::IdlePolicy &policy, Ready ready)
+{
+    for (auto i = 0u; i < policy.spins; ++i) {
+        if (ready()) {
+            return true;
+        }
+        cpuRelax();
+    }
+    for (auto i = 0u; i < policy.yields; ++i) {
+        if (ready()) {
+            return true;
+        }
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+} // namespace
+
+ThreadPool::ThreadPool() = default;
+
+ThreadPool::ThreadPool(Scheduling scheduling,
+                       std::size_t capacity,
+                       Order order) :
+    _queue(capacity, order),
+    _scheduling(scheduling)
+{ }
+
 ThreadPool::~ThreadPool()
 {
-    shutdown();
+    shutdown(Mode::Drain);
     wait();
 }
 
@@ -46,55 +261,454 @@ ThreadPool::wait()
 }
 
 void
-ThreadPool::shutdown()
+ThreadPool::idlePolicy(const IdlePolicy &policy)
+{
+    _spins.store(policy.spins, std::memory_order_relaxed);
+    _yields.store(policy.yields, std::memory_order_relaxed);
+}
+
+ThreadPool::IdlePolicy
+ThreadPool::idlePolicy() const
+{
+    return IdlePolicy{_spins.load(std::memory_order_relaxed),
+                      _yields.load(std::memory_order_relaxed)};
+}
+
+ThreadPool::Task
+ThreadPool::take(Clock::time_point &queued)
+{
+#ifdef CBI_POOL_STATS
+    auto task = _queue.take(queued);
+#else
+    (void)queued;
+    auto task = _queue.take();
+#endif
+    taken();
+    return task;
+}
+
+ThreadPool::Clock::time_point
+ThreadPool::stamp(const Node &node)
+{
+#ifdef CBI_POOL_STATS
+    return node.queued;
+#else
+    (void)node;
+    return Clock::time_point();
+#endif
+}
+
+ThreadPool::Stats
+ThreadPool::stats() const
+{
+    Stats stats;
+#ifdef CBI_POOL_STATS
+    auto l = Lock(_mutex);
+    stats.queued = _queue.size();
+    stats.peakQueued = _peakQueued;
+    stats.pending = _pending.load(std::memory_order_relaxed);
+    for (auto &c : _counters) {
+        Stats::Thread t;
+        t.tasks = c->tasks.load(std::memory_order_relaxed);
+        t.steals = c->steals.load(std::memory_order_relaxed);
+        t.wakeups = c->wakeups.load(std::memory_order_relaxed);
+        t.spurious = c->spurious.load(std::memory_order_relaxed);
+        t.busy = std::chrono::nanoseconds(c->busy.load(std::memory_order_relaxed));
+        stats.threads.push_back(t);
+
+        stats.total.tasks += t.tasks;
+        stats.total.steals += t.steals;
+        stats.total.wakeups += t.wakeups;
+        stats.total.spurious += t.spurious;
+        stats.total.busy += t.busy;
+
+        Stats::Histogram h;
+        Counters::read(c->queueLatency, h);
+        stats.queueLatency += h;
+        Counters::read(c->runTime, h);
+        stats.runTime += h;
+    }
+#endif
+    return stats;
+}
+
+void
+ThreadPool::run(Task &task, Counters &counters, Clock::time_point queued)
+{
+#ifdef CBI_POOL_STATS
+    auto start = Clock::now();
+    task();
+    counters.ran(queued, start, Clock::now());
+#else
+    (void)counters;
+    (void)queued;
+    task();
+#endif
+}
+
+std::size_t
+ThreadPool::size() const
+{
+    auto l = Lock(_mutex);
+    return _pool.size();
+}
+
+std::vector<ThreadPool::Task>
+ThreadPool::shutdown(Mode mode)
 {
+    std::vector<Task> dropped;
     auto l = lock();
-    _shutdown = true;
     _empty.notify_all();
+    _full.notify_all();
+    if (mode == Mode::Drain) {
+        _draining = true;
+        return dropped;
+    }
+
+    _shutdown = true;
+    while (auto task = _queue.take()) {
+        dropped.emplace_back(std::move(task));
+    }
+    _available = 0;
+    if (auto victims = _victims.load(std::memory_order_acquire)) {
+        for (auto w : *victims) {
+            while (!w->deque.empty()) {
+                if (auto node = w->deque.steal()) {
+                    dropped.emplace_back(std::move((*node)->task));
+                    (*node)->owner->giveBack(*node);
+                }
+            }
+        }
+    }
+    _pending.fetch_sub(dropped.size(), std::memory_order_acq_rel);
+    _idle.notify_all();
+    return dropped;
+}
+
+void
+ThreadPool::waitIdle()
+{
+    auto l = lock();
+    _idle.wait(l, [this]()
+        {
+            return _pending.load(std::memory_order_acquire) == 0 || _shutdown;
+        });
+}
+
+void
+ThreadPool::finished()
+{
+    if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        auto l = lock();
+        _idle.notify_all();
+    }
 }
 
 void
 ThreadPool::activate(std::size_t n)
 {
+    // Without CBI_POOL_STATS, every thread shares one empty Counters.
+    auto counters = [&]()
+    {
+#ifdef CBI_POOL_STATS
+        _counters.emplace_back(new Counters);
+        return _counters.back().get();
+#else
+        static Counters none;
+        return &none;
+#endif
+    };
+
     auto l = lock();
+    if (_scheduling == Scheduling::Shared) {
+        for (auto i = 0u; i < n; ++i) {
+            auto c = counters();
+            _pool.emplace_back(new std::thread([this, c]() { svc(*c); } ));
+        }
+        return;
+    }
+
+    // Publish a new snapshot of the workers before any of the new threads
+    // start, so that every thread can see every other.
+    std::vector<Worker*> created;
     for (auto i = 0u; i < n; ++i) {
-        _pool.emplace_back(new std::thread([this]() { svc(); } ));
+        _workers.emplace_back(new Worker(*this, _workers.size()));
+        created.push_back(_workers.back().get());
+    }
+    auto victims = std::make_unique<Workers>();
+    for (auto &w : _workers) {
+        victims->push_back(w.get());
+    }
+    _victims.store(victims.get(), std::memory_order_release);
+    _snapshots.emplace_back(std::move(victims));
+
+    for (auto w : created) {
+        auto c = counters();
+        _pool.emplace_back(new std::thread([this, w, c]()
+            {
+                svcStealing(*w, *c);
+            }));
     }
 }
 
 void
 ThreadPool::addTask(Task task)
+{
+    if (addLocal(task)) {
+        return;
+    }
+    addShared(std::move(task), 0);
+}
+
+void
+ThreadPool::addTask(Task task, Priority priority)
+{
+    addShared(std::move(task), priority);
+}
+
+void
+ThreadPool::addShared(Task &&task, Priority priority)
 {
     auto l = lock();
-    _queue.add(task);
-    _empty.notify_all();
+    _full.wait(l, [this]() { return !_queue.full() || _shutdown; });
+    if (_shutdown) {
+        return;
+    }
+    push(std::move(task), priority);
+}
+
+bool
+ThreadPool::tryAddTask(Task &&task)
+{
+    if (addLocal(task)) {
+        return true;
+    }
+    return tryAddTask(std::move(task), 0);
+}
+
+bool
+ThreadPool::tryAddTask(Task &&task, Priority priority)
+{
+    auto l = lock();
+    if (_queue.full() || _shutdown) {
+        return false;
+    }
+    push(std::move(task), priority);
+    return true;
+}
+
+bool
+ThreadPool::isLocal() const
+{
+    return _local && &_local->pool == this;
+}
+
+bool
+ThreadPool::addLocal(Task &task)
+{
+    if (!isLocal()) {
+        return false;
+    }
+    pushLocal(std::move(task));
+    wakeOne();
+    return true;
 }
 
 void
-ThreadPool::svc()
+ThreadPool::pushLocal(Task &&task)
 {
-    while (true) {
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    auto node = _local->allocate(std::move(task));
+#ifdef CBI_POOL_STATS
+    node->queued = Clock::now();
+#endif
+    _local->deque.push(node);
+}
+
+void
+ThreadPool::enqueue(Task &&task, Priority priority)
+{
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    _available.fetch_add(1, std::memory_order_relaxed);
+    _queue.add(std::move(task), priority);
+#ifdef CBI_POOL_STATS
+    _peakQueued = std::max(_peakQueued, _queue.size());
+#endif
+}
+
+void
+ThreadPool::push(Task &&task, Priority priority)
+{
+    enqueue(std::move(task), priority);
+    wakeLocked(1);
+}
+
+void
+ThreadPool::taken()
+{
+    _available.fetch_sub(1, std::memory_order_relaxed);
+    if (_queue.capacity()) {
+        _full.notify_one();
+    }
+}
+
+void
+ThreadPool::wake(std::size_t n)
+{
+    // Pairs with the fence in svcStealing(), so that either the sleeper sees
+    // the new task, or we see the sleeper.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (n == 0 || _sleepers.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    auto l = lock();
+    wakeLocked(n);
+}
+
+void
+ThreadPool::wakeLocked(std::size_t n)
+{
+    n = std::min(n, _sleepers.load(std::memory_order_relaxed));
+    while (n--) {
+        _empty.notify_one();
+    }
+}
+
+bool
+ThreadPool::stealable() const
+{
+    auto victims = _victims.load(std::memory_order_acquire);
+    if (!victims) {
+        return false;
+    }
+    for (auto w : *victims) {
+        if (!w->deque.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ThreadPool::Node*
+ThreadPool::steal(Worker &self)
+{
+    auto victims = _victims.load(std::memory_order_acquire);
+    auto n = victims->size();
+    auto start = self.random() % n;
+    for (auto i = 0u; i < n; ++i) {
+        auto victim = (*victims)[(start + i) % n];
+        if (victim == &self) {
+            continue;
+        }
+        if (auto node = victim->deque.steal()) {
+            return *node;
+        }
+    }
+    return nullptr;
+}
+
+void
+ThreadPool::svcStealing(Worker &self, Counters &counters)
+{
+    _local = &self;
+    while (!_shutdown.load(std::memory_order_relaxed)) {
+        Node *node = nullptr;
+        if (auto local = self.deque.pop()) {
+            node = *local;
+        } else if ((node = steal(self))) {
+            CBI_POOL_COUNT(counters.stole());
+        }
+        if (!node) {
+            spinUntil(idlePolicy(), [this, &self, &node]()
+                {
+                    if (_available.load(std::memory_order_relaxed) ||
+                        _shutdown.load(std::memory_order_relaxed) ||
+                        _draining.load(std::memory_order_relaxed)) {
+                        return true;
+                    }
+                    node = steal(self);
+                    return node != nullptr;
+                });
+            if (node) {
+                CBI_POOL_COUNT(counters.stole());
+            }
+        }
+        if (node) {
+            run(node->task, counters, stamp(*node));
+            self.release(node);
+            finished();
+            continue;
+        }
+
         auto l = lock();
-        _empty.wait(l, [this]() { return !_queue.empty() || _shutdown; });
         if (_shutdown) {
             return;
         }
         if (_queue.empty()) {
+            if (_draining) {
+                // Finished draining once there's nothing left to steal.
+                if (stealable()) {
+                    continue;
+                }
+                return;
+            }
+            _sleepers.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!(_shutdown || _draining || !_queue.empty() ||
+                     stealable())) {
+                _empty.wait(l);
+                CBI_POOL_COUNT(counters.woke(_shutdown || _draining ||
+                                             !_queue.empty() || stealable()));
+            }
+            _sleepers.fetch_sub(1);
             continue;
         }
+        Clock::time_point queued;
+        auto task = take(queued);
+        l.unlock();
+        run(task, counters, queued);
+        finished();
+    }
+}
+
+void
+ThreadPool::svc(Counters &counters)
+{
+    while (true) {
+        spinUntil(idlePolicy(), [this]()
+            {
+                return _available.load(std::memory_order_relaxed) ||
+                    _shutdown.load(std::memory_order_relaxed) ||
+                    _draining.load(std::memory_order_relaxed);
+            });
 
-        auto task = _queue.take();
-        if (task) {
-            l.unlock();
-            task();
+        auto l = lock();
+        if (_queue.empty() && !_shutdown && !_draining) {
+            _sleepers.fetch_add(1);
+            while (_queue.empty() && !_shutdown && !_draining) {
+                _empty.wait(l);
+                CBI_POOL_COUNT(counters.woke(!_queue.empty() || _shutdown ||
+                                             _draining));
+            }
+            _sleepers.fetch_sub(1);
         }
+        // If the queue is empty here, the pool is draining, and it's done.
+        if (_shutdown || _queue.empty()) {
+            return;
+        }
+
+        Clock::time_point queued;
+        auto task = take(queued);
+        l.unlock();
+        run(task, counters, queued);
+        finished();
     }
 }
 
 ThreadPool&
 operator<<(ThreadPool &pool, ThreadPool::Task task)
 {
-    pool.addTask(task);
+    pool.addTask(std::move(task));
     return pool;
 }
 
@@ -0,0 +1,402 @@
+/**
+ * The MIT License (MIT)
+ *
+ * @copyright
+ * Copyright (c) 2020 Rich Newman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @file
+ * @brief Implementation for fast_hash
+*/
+
+#include "CompuBrite/fast_hash.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CBI_FAST_HASH_X86 1
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CBI_FAST_HASH_NEON 1
+#endif
+
+namespace CompuBrite {
+
+namespace {
+
+/// The keys mixed into the stripes of a long string, (and the constants of
+/// a short one).  These are the output of splitmix64.
+alignas(32) const std::uint64_t Secret[32] = {
+    0x0bd2db2e48789d20ull, 0x7c621bc543b550a8ull, 0xb27410639e13de46ull, 0xd3c4eb1714b569e5ull,
+    0x9fc8be2266edda39ull, 0x491e4aceebe4be30ull, 0x180afb1a9570beb0ull, 0xca454537878d2950ull,
+    0xa96a98c828045478ull, 0xa4a4b920c8e15bf5ull, 0xae09d92fba683111ull, 0x1defe04876a32064ull,
+    0x1b830cede5f3a95full, 0x5d45a31f3dd3297full, 0x1b37fd03b9ada18eull, 0xa9cad3754033f149ull,
+    0x2bbe59b3c2df09d1ull, 0xc01f604b97fba984ull, 0xdad0325410c910f5ull, 0x0677e5dd8bdbadf9ull,
+    0x2bc9abfd44bc3b36ull, 0x08cf102312742cefull, 0x495cf4650c95833dull, 0x288961efe041bc37ull,
+    0x98ed752e258e01f9ull, 0xc52d415200f3564bull, 0xcdd458acbdd6c870ull, 0x566084b17ea38725ull,
+    0xe7542a38b9d1fea3ull, 0xdd9d16547d375b50ull, 0x96ba0d35cbccf939ull, 0x9da04ee13d14edb1ull,
+};
+
+/// The initial values of the accumulators for a long string.
+const std::uint64_t Initial[8] = {
+    0xbfc89fcb4a535a79ull, 0xee70dbcc615f6037ull, 0xd9fff4fa18bdbaf2ull, 0x010f635b4475cb04ull,
+    0xaf6bf13753c2781full, 0x9267e18291c49804ull, 0x98eeaccf6674a5feull, 0x1befe3186370c73bull,
+};
+
+constexpr std::uint32_t ScramblePrime = 0x9E3779B1u;
+constexpr std::size_t   StripeLen = 64;
+constexpr std::size_t   StripesPerBlock = 16;
+constexpr std::size_t   BlockLen = StripeLen * StripesPerBlock;
+constexpr std::size_t   LastStripeKey = 23;
+constexpr std::size_t   ScrambleKey = 24;
+
+/// @return the little endian 64 bit value at p.
+inline std::uint64_t read64(const unsigned char *p)
+{
+    std::uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/// @return the little endian 32 bit value at p.
+inline std::uint64_t read32(const unsigned char *p)
+{
+    std::uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+/// @return the high and low halves of the 128 bit product a * b, folded
+/// together.
+inline std::uint64_t mix(std::uint64_t a, std::uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    auto r = static_cast<unsigned __int128>(a) * b;
+    return static_cast<std::uint64_t>(r) ^ static_cast<std::uint64_t>(r >> 64);
+#else
+    std::uint64_t ha = a >> 32, hb = b >> 32, la = std::uint32_t(a), lb = std::uint32_t(b);
+    std::uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    std::uint64_t t = rl + (rm0 << 32);
+    std::uint64_t c = t < rl;
+    std::uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    std::uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
+
+/// @return the hash of up to 64 bytes.
+std::uint64_t hashShort(const unsigned char *p, std::size_t len, std::uint64_t seed)
+{
+    std::uint64_t h = seed ^ Secret[0];
+    std::uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            auto off = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + off);
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - off);
+        } else if (len > 0) {
+            a = (std::uint64_t(p[0]) << 16) | (std::uint64_t(p[len >> 1]) << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        for (auto q = p, end = p + len - 16; q < end; q += 16) {
+            h = mix(read64(q) ^ Secret[1], read64(q + 8) ^ h);
+        }
+        a = read64(p + len - 16);
+        b = read64(p + len - 8);
+    }
+    return mix(mix(a ^ Secret[2], b ^ h) ^ Secret[3], len ^ Secret[4]);
+}
+
+/// The operations on the accumulators of a long string, (which the SIMD
+/// implementations do several lanes at a time).
+struct Kernel
+{
+    /// Mix count 64 byte stripes at p into acc, with the keys for stripe s
+    /// starting at keys + s.
+    void (*accumulate)(std::uint64_t *acc, const unsigned char *p,
+                       std::size_t count, const std::uint64_t *keys);
+
+    /// Scramble acc with the given keys, after each block.
+    void (*scramble)(std::uint64_t *acc, const std::uint64_t *keys);
+};
+
+void accumulateScalar(std::uint64_t *acc, const unsigned char *p,
+                      std::size_t count, const std::uint64_t *keys)
+{
+    for (std::size_t s = 0; s < count; ++s, p += StripeLen) {
+        for (std::size_t i = 0; i < 8; ++i) {
+            auto d = read64(p + 8 * i);
+            auto dk = d ^ keys[s + i];
+            acc[i] += (dk & 0xFFFFFFFFu) * (dk >> 32) + read64(p + 8 * (i ^ 1));
+        }
+    }
+}
+
+void scrambleScalar(std::uint64_t *acc, const std::uint64_t *keys)
+{
+    for (std::size_t i = 0; i < 8; ++i) {
+        auto a = acc[i];
+        a ^= a >> 47;
+        a ^= keys[i];
+        acc[i] = a * ScramblePrime;
+    }
+}
+
+#if defined(CBI_FAST_HASH_X86) && defined(__SSE2__)
+#define CBI_FAST_HASH_SSE2 1
+
+void accumulateSse2(std::uint64_t *acc, const unsigned char *p,
+                    std::size_t count, const std::uint64_t *keys)
+{
+    auto a = reinterpret_cast<__m128i*>(acc);
+    for (std::size_t s = 0; s < count; ++s, p += StripeLen) {
+        for (std::size_t i = 0; i < 4; ++i) {
+            auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p) + i);
+            auto k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + s) + i);
+            auto dk = _mm_xor_si128(d, k);
+            auto product = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+            auto swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+        }
+    }
+}
+
+void scrambleSse2(std::uint64_t *acc, const std::uint64_t *keys)
+{
+    auto a = reinterpret_cast<__m128i*>(acc);
+    auto prime = _mm_set1_epi32(static_cast<int>(ScramblePrime));
+    for (std::size_t i = 0; i < 4; ++i) {
+        auto v = _mm_xor_si128(a[i], _mm_srli_epi64(a[i], 47));
+        v = _mm_xor_si128(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys) + i));
+        auto lo = _mm_mul_epu32(v, prime);
+        auto hi = _mm_mul_epu32(_mm_srli_epi64(v, 32), prime);
+        a[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+    }
+}
+#endif
+
+#if defined(CBI_FAST_HASH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CBI_FAST_HASH_AVX2 1
+
+__attribute__((target("avx2")))
+void accumulateAvx2(std::uint64_t *acc, const unsigned char *p,
+                    std::size_t count, const std::uint64_t *keys)
+{
+    auto a = reinterpret_cast<__m256i*>(acc);
+    for (std::size_t s = 0; s < count; ++s, p += StripeLen) {
+        for (std::size_t i = 0; i < 2; ++i) {
+            auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p) + i);
+            auto k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + s) + i);
+            auto dk = _mm256_xor_si256(d, k);
+            auto product = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+            auto swapped = _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm256_add_epi64(a[i], _mm256_add_epi64(product, swapped));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void scrambleAvx2(std::uint64_t *acc, const std::uint64_t *keys)
+{
+    auto a = reinterpret_cast<__m256i*>(acc);
+    auto prime = _mm256_set1_epi32(static_cast<int>(ScramblePrime));
+    for (std::size_t i = 0; i < 2; ++i) {
+        auto v = _mm256_xor_si256(a[i], _mm256_srli_epi64(a[i], 47));
+        v = _mm256_xor_si256(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys) + i));
+        auto lo = _mm256_mul_epu32(v, prime);
+        auto hi = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), prime);
+        a[i] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+    }
+}
+#endif
+
+#ifdef CBI_FAST_HASH_NEON
+void accumulateNeon(std::uint64_t *acc, const unsigned char *p,
+                    std::size_t count, const std::uint64_t *keys)
+{
+    for (std::size_t s = 0; s < count; ++s, p += StripeLen) {
+        for (std::size_t i = 0; i < 4; ++i) {
+            auto a = vld1q_u64(acc + 2 * i);
+            auto d = vreinterpretq_u64_u8(vld1q_u8(p + 16 * i));
+            auto dk = veorq_u64(d, vld1q_u64(keys + s + 2 * i));
+            auto product = vmull_u32(vmovn_u64(dk), vshrn_n_u64(dk, 32));
+            auto swapped = vextq_u64(d, d, 1);
+            vst1q_u64(acc + 2 * i, vaddq_u64(a, vaddq_u64(product, swapped)));
+        }
+    }
+}
+
+void scrambleNeon(std::uint64_t *acc, const std::uint64_t *keys)
+{
+    auto prime = vdup_n_u32(ScramblePrime);
+    for (std::size_t i = 0; i < 4; ++i) {
+        auto v = vld1q_u64(acc + 2 * i);
+        v = veorq_u64(v, vshrq_n_u64(v, 47));
+        v = veorq_u64(v, vld1q_u64(keys + 2 * i));
+        auto lo = vmull_u32(vmovn_u64(v), prime);
+        auto hi = vmull_u32(vshrn_n_u64(v, 32), prime);
+        vst1q_u64(acc + 2 * i, vaddq_u64(lo, vshlq_n_u64(hi, 32)));
+    }
+}
+#endif
+
+/// @return the kernel for the given implementation, or nullptr if it isn't
+/// supported.
+const Kernel* kernel(fast_hash_isa isa)
+{
+    static const Kernel scalar{&accumulateScalar, &scrambleScalar};
+    switch (isa) {
+    case fast_hash_isa::scalar:
+        return &scalar;
+    case fast_hash_isa::sse2:
+#ifdef CBI_FAST_HASH_SSE2
+        {
+            static const Kernel sse2{&accumulateSse2, &scrambleSse2};
+            return &sse2;
+        }
+#else
+        break;
+#endif
+    case fast_hash_isa::avx2:
+#ifdef CBI_FAST_HASH_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            static const Kernel avx2{&accumulateAvx2, &scrambleAvx2};
+            return &avx2;
+        }
+#endif
+        break;
+    case fast_hash_isa::neon:
+#ifdef CBI_FAST_HASH_NEON
+        {
+            static const Kernel neon{&accumulateNeon, &scrambleNeon};
+            return &neon;
+        }
+#else
+        break;
+#endif
+    }
+    return nullptr;
+}
+
+/// @return the best implementation this machine supports.
+fast_hash_isa best()
+{
+    for (auto isa : {fast_hash_isa::avx2, fast_hash_isa::neon, fast_hash_isa::sse2}) {
+        if (kernel(isa)) {
+            return isa;
+        }
+    }
+    return fast_hash_isa::scalar;
+}
+
+/// @return the implementation chosen, (once), for fast_hash().  This may
+/// be called while other static objects are being constructed, (to intern
+/// their strings), so it can't be a static object itself.
+fast_hash_isa selected()
+{
+    static const fast_hash_isa isa = best();
+    return isa;
+}
+
+const Kernel& chosen()
+{
+    static const Kernel &k = *kernel(selected());
+    return k;
+}
+
+/// @return the hash of more than 64 bytes.
+std::uint64_t hashLong(const Kernel &k, const unsigned char *p, std::size_t len,
+                       std::uint64_t seed)
+{
+    alignas(32) std::uint64_t acc[8];
+    for (std::size_t i = 0; i < 8; ++i) {
+        acc[i] = Initial[i] ^ seed;
+    }
+
+    const auto blocks = (len - 1) / BlockLen;
+    for (std::size_t b = 0; b < blocks; ++b) {
+        k.accumulate(acc, p + b * BlockLen, StripesPerBlock, Secret);
+        k.scramble(acc, Secret + ScrambleKey);
+    }
+    const auto stripes = ((len - 1) - blocks * BlockLen) / StripeLen;
+    k.accumulate(acc, p + blocks * BlockLen, stripes, Secret);
+    k.accumulate(acc, p + len - StripeLen, 1, Secret + LastStripeKey);
+
+    std::uint64_t h = (len * 0x9E3779B185EBCA87ull) ^ seed;
+    for (std::size_t i = 0; i < 4; ++i) {
+        h += mix(acc[2 * i] ^ Secret[11 + 2 * i], acc[2 * i + 1] ^ Secret[12 + 2 * i]);
+    }
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ull;
+    return h ^ (h >> 32);
+}
+
+} // namespace
+
+bool
+fast_hash_supported(fast_hash_isa isa)
+{
+    return kernel(isa) != nullptr;
+}
+
+fast_hash_isa
+fast_hash_selected()
+{
+    return selected();
+}
+
+std::uint64_t
+fast_hash(const void *data, std::size_t size, std::uint64_t seed)
+{
+    auto p = static_cast<const unsigned char*>(data);
+    if (size <= StripeLen) {
+        return hashShort(p, size, seed);
+    }
+    return hashLong(chosen(), p, size, seed);
+}
+
+std::uint64_t
+fast_hash(fast_hash_isa isa, const void *data, std::size_t size, std::uint64_t seed)
+{
+    auto k = kernel(isa);
+    if (!k) {
+        throw std::invalid_argument("fast_hash: unsupported implementation");
+    }
+    auto p = static_cast<const unsigned char*>(data);
+    if (size <= StripeLen) {
+        return hashShort(p, size, seed);
+    }
+    return hashLong(*k, p, size, seed);
+}
+
+} // namespace CompuBrite
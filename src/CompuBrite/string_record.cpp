@@ -23,28 +23,6 @@
 
 #include "CompuBrite/string_record.h"
 
-namespace CompuBrite {
-
-string_record::Strings string_record::_strings;
-string_record::Map     string_record::_map;
-
-
-string_record::string_record()
-{
-    _index = _strings.size();
-}
-
-string_record
-string_record::from_string(const std::string &str)
-{
-    auto found = _map.find(str);
-    if (found != _map.end()) {
-        return found->second;
-    }
-    string_record r;
-    _strings.emplace_back(str);
-    _map.insert( {str, r} );
-    return r;
-}
-
-} // namespace CompuBrite
+#ifndef CBI_HEADER_ONLY
+#include "CompuBrite/string_record.ipp"
+#endif
@@ -25,8 +25,17 @@
 
 #include "CompuBrite/CheckPoint.h"
 #include "CompuBrite/ThreadPool.h"
+#include "CompuBrite/fast_hash.h"
+#include "CompuBrite/flat_map.h"
+#include "CompuBrite/hash_util.h"
+#include "CompuBrite/parallel.h"
 #include "CompuBrite/string_record.h"
+#include "CompuBrite/type_map.h"
+#include "CompuBrite/visit.h"
+#include "CompuBrite/is_member_of.h"
+#include "CompuBrite/overloaded.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <vector>
@@ -34,6 +43,11 @@
 #include <future>
 #include <exception>
 #include <numeric>
+#include <atomic>
+#include <thread>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 
 namespace cbi = CompuBrite;
 
@@ -50,6 +64,10 @@ void test_checkpoints()
     // Use convenience macro for the same purpose as above.
     CBI_INVARIANT(CBI_HERE, (j == 42), "(macro) j changed to: ", std::ref(j));
 
+    // A plain ScopeGuard, which is dismissed before it can fire.
+    auto never = cbi::make_scope_guard([]() { std::cout << "Never printed\n"; });
+    never.dismiss();
+
     // Create a debugging CheckPoint "point1"
     cbi::CheckPoint point1("test1");
 
@@ -93,9 +111,93 @@ void test_checkpoints()
     // Create a temporary CheckPoint and print it if it's enabled.
     cbi::CheckPoint("test3").print(CBI_HERE, "test3\n");
 
+    // The same, but the category is only looked up the first time through.
+    for (auto i = 0; i < 3; ++i) {
+        cbi::CheckPoint(CBI_CATEGORY("test3")).print(CBI_HERE, "test3 loop ", i, "\n");
+    }
+
+    // Turn on "test4" at run-time, then go back to CBI_CHECKPOINTS.
+    cbi::CheckPoint test4("test4");
+    cbi::CheckPoint::reload("test4");
+    test4.print(CBI_HERE, "test4 reloaded, active = ", test4.active(), "\n");
+    cbi::CheckPoint::reload();
+    std::cout << "test4 active after reload = " << test4.active() << std::endl;
+
+    // The same checks through call sites which keep their own flags.
+    for (auto i = 0; i < 3; ++i) {
+        CBI_PRINT("test5", "test5 site ", i, "\n");
+    }
+    CBI_EXPECT(j == 42, "(site) j changed to: ", j, "\n");
+
     j = 24;   // Violate the invariant.
 }
 
+void test_checkpoint_trace()
+{
+    // Record messages in binary, then decode them, (as the cbi_trace tool
+    // does).
+    auto path = std::filesystem::temp_directory_path() / "cbi_test.trace";
+    cbi::CheckPoint::enable("trace");
+    cbi::CheckPoint::binary_output(true, path.string());
+    cbi::CheckPoint trace("trace");
+    for (auto i = 0; i < 3; ++i) {
+        trace.print(CBI_HERE, "binary ", i, ' ', i * 0.5);
+    }
+    cbi::CheckPoint::binary_output(false);
+    cbi::CheckPoint::disable("trace");
+
+    std::ifstream in(path, std::ios::binary);
+    auto decoded = cbi::CheckPoint::decode(in, std::cout);
+    std::cout << "trace decoded: " << decoded << std::endl;
+    std::filesystem::remove(path);
+
+    // A message for a site which was never defined is refused.
+    std::string orphan(1 + 4 * 3 + 8 + 4, '\0');
+    orphan[0] = 'E';
+    std::istringstream bad(orphan);
+    std::ostringstream ignored;
+    std::cout << "orphan trace refused: "
+              << !cbi::CheckPoint::decode(bad, ignored) << std::endl;
+}
+
+void test_checkpoint_timings()
+{
+    // Time a scope, (only while "timed" is enabled), then print the
+    // percentiles.
+    cbi::CheckPoint::enable("timed");
+    for (auto i = 0; i < 100; ++i) {
+        CBI_TIMED("timed");
+        std::this_thread::sleep_for(std::chrono::microseconds(i % 10 ? 10 : 100));
+    }
+
+    // A site first reached on one thread, then used on another, (which
+    // only hears of it through a relaxed flag, so the site itself must
+    // publish its category under -fsanitize=thread).
+    std::atomic<bool> warm{false};
+    std::atomic<bool> done{false};
+    auto timed = []() { CBI_TIMED("timed"); };
+    std::thread first([&]()
+        {
+            timed();
+            warm.store(true, std::memory_order_relaxed);
+            while (!done.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+        });
+    std::thread second([&]()
+        {
+            while (!warm.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+            timed();
+            done.store(true, std::memory_order_relaxed);
+        });
+    first.join();
+    second.join();
+    cbi::CheckPoint::disable("timed");
+    cbi::CheckPoint::dump_timings(std::cout);
+}
+
 void test_threadpool()
 {
     cbi::ThreadPool pool;
@@ -124,10 +226,11 @@ void test_threadpool()
         cbi::CheckPoint::hit(CBI_HERE, "r = ", r);
         return r;
     };
-    auto promise = pool.addTask<int>(work);
+    auto future = pool.submit(work);
     sleep(1);
-    auto future = promise.get_future();
-    for (auto i = sleepDuration; i > 0; --i) {
+    // The accum task is queued behind the sleeping tasks, so allow it time
+    // to get to the front of the queue, and then to run.
+    for (auto i = sleepDuration * 2u; i > 0; --i) {
         std::cout << i << std::endl;
         std::chrono::milliseconds span(1000);
         if (future.wait_for(span) == std::future_status::timeout) {
@@ -139,6 +242,7 @@ void test_threadpool()
         } catch (const std::exception &e) {
             std::cout << e.what() << std::endl;
         }
+        break;
     }
     sleep(3);
     pool.shutdown();
@@ -146,6 +250,165 @@ void test_threadpool()
 
 }
 
+void test_threadpool_stealing()
+{
+    cbi::ThreadPool pool(cbi::ThreadPool::Scheduling::WorkStealing);
+    pool.activate(4);
+
+    // Each outer task goes onto the shared queue, and then fans out into
+    // inner tasks on the deque of whichever thread runs it.  Idle threads
+    // steal the inner tasks.
+    const auto outer = 8, inner = 100;
+    std::atomic<int> done{0};
+    for (auto i = 0; i < outer; ++i) {
+        pool << [&pool, &done]()
+        {
+            for (auto j = 0; j < inner; ++j) {
+                pool << [&done]() { ++done; };
+            }
+        };
+    }
+    while (done != outer * inner) {
+        std::this_thread::yield();
+    }
+    std::cout << "work stealing ran " << done << " tasks" << std::endl;
+    pool.shutdown();
+    pool.wait();
+}
+
+void test_threadpool_submit_once()
+{
+    // The task runs once, so submit() calls its callable as an rvalue, (as
+    // the future's type says it will).
+    struct Once
+    {
+        std::string operator()() &&     { return "rvalue"; }
+        int operator()() &              { return 0; }
+    };
+    cbi::ThreadPool pool;
+    pool.activate(1);
+    auto future = pool.submit(Once{});
+    std::cout << "submit once: " << future.get() << std::endl;
+    pool.shutdown();
+    pool.wait();
+}
+
+void test_threadpool_bounded()
+{
+    // At most 4 tasks may wait in the queue; addTask() blocks the producer
+    // until the workers make room.
+    cbi::ThreadPool pool(cbi::ThreadPool::Scheduling::Shared, 4);
+    pool.activate(2);
+    std::atomic<int> done{0};
+    for (auto i = 0; i < 100; ++i) {
+        pool.addTask([&done]() { ++done; });
+    }
+    while (done != 100) {
+        std::this_thread::yield();
+    }
+    std::cout << "bounded pool ran " << done << " tasks" << std::endl;
+    pool.shutdown();
+    pool.wait();
+}
+
+void test_threadpool_priority()
+{
+    // Queue the tasks before starting the thread, so that they are all
+    // waiting, then watch them come out highest priority first.
+    cbi::ThreadPool pool(cbi::ThreadPool::Scheduling::Shared, 0,
+                         cbi::ThreadPool::Order::Priority);
+    std::mutex mutex;
+    std::vector<int> order;
+    for (auto p : {3, 1, 4, 1, 5, 9, 2, 6}) {
+        pool.addTask([p, &mutex, &order]()
+            {
+                std::lock_guard<std::mutex> l(mutex);
+                order.push_back(p);
+            }, p);
+    }
+    pool.activate(1);
+    while (true) {
+        std::lock_guard<std::mutex> l(mutex);
+        if (order.size() == 8) {
+            break;
+        }
+    }
+    std::cout << "priority order:";
+    for (auto p : order) {
+        std::cout << ' ' << p;
+    }
+    std::cout << std::endl;
+    pool.shutdown();
+    pool.wait();
+}
+
+void test_threadpool_shutdown()
+{
+    std::atomic<int> done{0};
+    {
+        // Drain: every task which was queued gets run before the threads
+        // terminate.
+        cbi::ThreadPool pool;
+        pool.activate(4);
+        for (auto i = 0; i < 50; ++i) {
+            pool << [&done]() { ++done; };
+        }
+        pool.waitIdle();
+        std::cout << "idle after " << done << " tasks" << std::endl;
+        for (auto i = 0; i < 50; ++i) {
+            pool << [&done]() { ++done; };
+        }
+        pool.shutdown(cbi::ThreadPool::Mode::Drain);
+        pool.wait();
+        std::cout << "drained " << done << " tasks" << std::endl;
+    }
+
+    // Immediate: the tasks which hadn't started, (none have, since there
+    // are no threads), are handed back.
+    cbi::ThreadPool pool;
+    for (auto i = 0; i < 50; ++i) {
+        pool << [&done]() { ++done; };
+    }
+    auto dropped = pool.shutdown(cbi::ThreadPool::Mode::Immediate);
+    std::cout << "dropped " << dropped.size() << " tasks" << std::endl;
+}
+
+void test_threadpool_stats()
+{
+    if (!cbi::ThreadPool::Stats::enabled) {
+        std::cout << "pool stats not enabled (define CBI_POOL_STATS)" << std::endl;
+        return;
+    }
+    cbi::ThreadPool pool(cbi::ThreadPool::Scheduling::WorkStealing);
+    pool.activate(4);
+    for (auto i = 0; i < 100; ++i) {
+        pool << []() { std::this_thread::sleep_for(std::chrono::microseconds(10)); };
+    }
+    pool.waitIdle();
+    auto stats = pool.stats();
+    std::cout << "stats: " << stats.total.tasks << " tasks, "
+              << stats.total.steals << " steals, peak queued "
+              << stats.peakQueued << ", p50 wait "
+              << stats.queueLatency.percentile(50).count() << "ns, p99 run "
+              << stats.runTime.percentile(99).count() << "ns" << std::endl;
+}
+
+void test_parallel()
+{
+    cbi::ThreadPool pool;
+    pool.activate(4);
+
+    std::vector<int> v(10000);
+    cbi::parallel_for(pool, std::size_t{0}, v.size(),
+                      [&v](std::size_t i) { v[i] = static_cast<int>(i % 7); }, 256);
+    auto sum = cbi::parallel_reduce(pool, v.begin(), v.end(), 0,
+                                    std::plus<>(), 256);
+    std::cout << "parallel sum = " << sum << ", expected "
+              << std::accumulate(v.begin(), v.end(), 0) << std::endl;
+    pool.shutdown();
+    pool.wait();
+}
+
 void test_string_record1()
 {
     std::string hello("hello");
@@ -162,6 +425,13 @@ void test_string_record1()
     if (r1.index() == r2.index()) {
         std::cout << "unequal strings fail." << std::endl;
     }
+
+    // Slices of a larger buffer are looked up without copying them.
+    std::string_view text("hello world");
+    auto r4 = cbi::string_record::from_string(text.substr(6));
+    if (r4 == r2) {
+        std::cout << "string_view pass" << std::endl;
+    }
 }
 
 void test_string_record2()
@@ -176,11 +446,209 @@ void test_string_record2()
     std::cout << "r3 = " << r3.string() << ", " << r3.index() << std::endl;
 }
 
+void test_string_record3()
+{
+    // Record the same strings from several threads at once; every thread
+    // sees the same index for each string.
+    cbi::ThreadPool pool;
+    pool.activate(4);
+    std::vector<std::size_t> indices(4000);
+    cbi::parallel_for(pool, std::size_t{0}, indices.size(), [&indices](std::size_t i)
+        {
+            auto r = cbi::string_record::from_string("sym" + std::to_string(i % 1000));
+            indices[i] = r.index();
+        }, 16);
+    auto same = true;
+    for (auto i = 1000u; i < indices.size(); ++i) {
+        same = same && indices[i] == indices[i % 1000];
+    }
+    std::cout << "concurrent strings " << (same ? "pass" : "fail") << std::endl;
+}
+
+void test_string_pool()
+{
+    // A pool for a single document, whose strings are all freed with it.
+    cbi::string_pool doc(1);
+    auto a = doc.from_string("hello");
+    auto b = doc.from_string("local");
+    auto g = cbi::string_record::from_string("hello");
+    std::cout << "pool: " << a.string() << " " << a.index() << ", "
+              << b.string() << " " << b.index() << ", size " << doc.size()
+              << ", same as global " << (a == g ? "yes" : "no") << std::endl;
+}
+
+void test_string_pool_snapshot()
+{
+    // Record a batch of strings, save them, and map them back, with the
+    // same indices.
+    std::vector<std::string> names{"alpha", "beta", "gamma", "beta"};
+    auto path = (std::filesystem::temp_directory_path() / "cbi_string_pool.snap").string();
+    {
+        cbi::string_pool pool;
+        auto records = pool.from_strings(names);
+        std::cout << "batch: " << records[1].index() << " " << records[3].index()
+                  << ", size " << pool.size() << std::endl;
+        pool.save(path);
+    }
+    auto mapped = cbi::string_pool::map(path);
+    std::cout << "mapped: gamma " << mapped->from_string("gamma").index()
+              << ", delta " << mapped->from_string("delta").index() << std::endl;
+
+    // A truncated or corrupt snapshot is refused, rather than mapped.
+    std::string good;
+    {
+        std::ifstream in(path, std::ios::binary);
+        good.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto refused = [&path](const std::string &bytes)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes;
+        try {
+            cbi::string_pool::map(path);
+        } catch (const std::runtime_error &) {
+            return true;
+        }
+        return false;
+    };
+    auto poke = [](std::string bytes, std::size_t at, std::uint64_t value,
+                   std::size_t size = 8)
+    {
+        return bytes.replace(at, size, reinterpret_cast<const char*>(&value), size);
+    };
+    // The header's count is at 24, and its slots at 32.  The index follows
+    // the offsets and hashes of the 3 strings.
+    auto index = 48 + 7 * 8;
+    // An index with no empty slot would make a lookup which misses spin.
+    auto full = good;
+    for (std::size_t i = 0; i < 16; ++i) {
+        full = poke(full, index + i * 4, 1, 4);
+    }
+    bool pass = refused(good.substr(0, good.size() - 1)) &&
+                refused(poke(poke(good, 24, 0), 32, 0)) &&
+                refused(poke(good, 32, 3)) &&
+                refused(poke(good, index, 99, 4)) &&
+                refused(full) &&
+                refused(poke(good, good.size() - 1, 'x', 1));
+    std::cout << "corrupt snapshots: " << (pass ? "pass" : "fail") << std::endl;
+    std::filesystem::remove(path);
+}
+
+void test_string_order()
+{
+    // Sort records by their strings, using ranks made once for the pool.
+    cbi::string_pool pool;
+    auto records = pool.from_strings(std::vector<std::string>{"pear", "apple", "fig"});
+    cbi::string_ranks ranks(pool);
+    std::sort(records.begin(), records.end(), cbi::string_less(ranks));
+    std::cout << "sorted:";
+    for (auto &r : records) {
+        std::cout << " " << r.string_view();
+    }
+    std::cout << ", hash cached "
+              << (records[0].hash() == cbi::fast_hash("apple") ? "pass" : "fail")
+              << std::endl;
+}
+
+void test_hash_util()
+{
+    // Swapped and repeated pairs no longer collide.
+    auto ab = std::make_hash(1, 2), ba = std::make_hash(2, 1);
+    auto aa = std::hash<std::pair<int, int>>()({1, 1});
+    auto bb = std::hash<std::pair<int, int>>()({2, 2});
+    auto tuple = std::hash<std::tuple<int, std::string, double>>()({1, "two", 3.0});
+    std::cout << "hash: (1,2) " << (ab != ba ? "!=" : "==") << " (2,1), (1,1) "
+              << (aa != bb ? "!=" : "==") << " (2,2), tuple "
+              << (tuple == std::make_hash(1, std::string("two"), 3.0) ? "pass" : "fail")
+              << std::endl;
+}
+
+void test_fast_hash()
+{
+    // Every implementation gives the same hash, (short and long strings).
+    std::string text;
+    for (auto i = 0; i < 100; ++i) {
+        text += "CompuBrite fast_hash " + std::to_string(i);
+    }
+    bool same = true;
+    for (auto isa : {cbi::fast_hash_isa::sse2, cbi::fast_hash_isa::avx2,
+                     cbi::fast_hash_isa::neon}) {
+        if (!cbi::fast_hash_supported(isa)) {
+            continue;
+        }
+        for (auto len : {0u, 3u, 16u, 64u, 65u, 1000u, 2345u}) {
+            same = same && cbi::fast_hash(isa, text.data(), len) ==
+                           cbi::fast_hash(cbi::fast_hash_isa::scalar, text.data(), len);
+        }
+    }
+    std::cout << "fast_hash: implementation " << static_cast<int>(cbi::fast_hash_selected())
+              << ", " << (same ? "pass" : "fail") << std::endl;
+}
+
+void test_flat_map()
+{
+    // Look strings up by string_view, without making a std::string.
+    cbi::flat_map<std::string, int> counts;
+    for (auto word : {"to", "be", "or", "not", "to", "be"}) {
+        ++counts[word];
+    }
+    std::string_view be("be");
+    counts.erase("or");
+    std::cout << "flat_map: " << counts.size() << " words, be " << counts.at(be)
+              << ", or " << counts.count("or") << std::endl;
+}
+
+void test_type_map()
+{
+    // Turn a run-time id back into the type it came from.
+    using Sizes = cbi::type_map<cbi::pair<char, int>, cbi::pair<double, long>,
+                                cbi::pair<std::string, short>>;
+    static_assert(Sizes::index_of<double> == 1 && !Sizes::has<float>());
+    std::size_t id = Sizes::index_of<std::string>;
+    auto size = Sizes::dispatch(id, [](auto key, auto value)
+        {
+            return sizeof(typename decltype(key)::type) + sizeof(typename decltype(value)::type);
+        });
+    std::cout << "type_map: dispatch "
+              << (size == sizeof(std::string) + sizeof(short) ? "pass" : "fail") << std::endl;
+}
+
+void test_visit()
+{
+    // Visit a pair of variants with one switch.
+    using Value = std::variant<int, double, std::string>;
+    static_assert(cbi::index_in_v<double, Value> == 1 && cbi::is_member_of_v<double, Value>);
+    Value text = std::string("abc"), number = 2.5;
+    auto describe = cbi::overloaded{
+        [](const std::string &s, double d) { return s + " " + std::to_string(d); },
+        [](const auto &, const auto &) { return std::string("other"); }
+    };
+    std::cout << "visit: " << cbi::visit(describe, text, number) << ", "
+              << cbi::visit(describe, number, text) << std::endl;
+}
+
 int main()
 {
     test_checkpoints();
+    test_checkpoint_trace();
+    test_checkpoint_timings();
     test_threadpool();
+    test_threadpool_stealing();
+    test_threadpool_submit_once();
+    test_threadpool_bounded();
+    test_threadpool_priority();
+    test_threadpool_shutdown();
+    test_threadpool_stats();
+    test_parallel();
     test_string_record1();
     test_string_record2();
+    test_string_record3();
+    test_string_pool();
+    test_string_pool_snapshot();
+    test_string_order();
+    test_hash_util();
+    test_fast_hash();
+    test_flat_map();
+    test_type_map();
+    test_visit();
     return 0;
 }